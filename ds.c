@@ -1,15 +1,35 @@
 /* smart_parking.c
    Self-contained Smart Parking System (single-file)
-   - min-heap for free slot allocation
-   - circular waiting queue
+   - d-ary min-heap per zone for free slot allocation
+   - circular waiting queue per zone
    - parking history (linked list)
    - safer input (fgets + sscanf)
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* CPU affinity */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #define MAX_SLOTS 10
 #define MAX_CARS 100
@@ -17,345 +37,7000 @@
 #define FEE_PER_HOUR 50
 
 /* ----- Heap (min-heap of free slots) ----- */
-int heapArr[MAX_SLOTS + 1]; /* 1-based heap */
-int heapSize = 0;
-
-void heapSwap(int i, int j) {
-    int t = heapArr[i];
-    heapArr[i] = heapArr[j];
-    heapArr[j] = t;
-}
-
-void heapInsert(int val) {
-    if (heapSize >= MAX_SLOTS) return;
-    heapSize++;
-    heapArr[heapSize] = val;
-    int i = heapSize;
-    while (i > 1) {
-        int parent = i / 2;
-        if (heapArr[parent] <= heapArr[i]) break;
-        heapSwap(parent, i);
-        i = parent;
-    }
-}
-
-int heapRemoveMin() {
-    if (heapSize == 0) return -1;
-    int ret = heapArr[1];
-    heapArr[1] = heapArr[heapSize];
-    heapSize--;
-    int i = 1;
+/* d-ary min-heap, arity picked at compile time with -DHEAP_ARITY=2|4|8.
+   Node k (0-based) has its children at d*k+1 .. d*k+d. Storage is shifted
+   by d-1 so every sibling group starts on a multiple of d ints and sits in
+   a single 64-byte line (d <= 16). Slots past the end hold HEAP_EMPTY, so
+   picking the smallest child needs no bounds checks and no branches.
+   With d == 2 this is the classic 1-based binary heap. */
+#ifndef HEAP_ARITY
+#define HEAP_ARITY 8
+#endif
+#define HEAP_EMPTY INT_MAX
+#define CACHE_LINE 64
+
+typedef struct {
+    int *arr;   /* node k at arr[k + HEAP_ARITY - 1] */
+    int size;
+    int cap;
+} SlotHeap;
+
+/* ints needed to back a heap of cap entries for arity d */
+#define HEAP_STORE_LEN(cap, d) ((((cap) + 2 * (d)) + 15) & ~15)
+
+#define DEFINE_DARY_HEAP(D)                                                  \
+static void dheap##D##Reset(SlotHeap *h) {                                   \
+    for (int i = 0; i < HEAP_STORE_LEN(h->cap, D); i++) h->arr[i] = HEAP_EMPTY; \
+    h->size = 0;                                                             \
+}                                                                            \
+static void dheap##D##Insert(SlotHeap *h, int val) {                         \
+    int *a = h->arr + (D - 1);                                               \
+    int k = h->size++;                                                       \
+    while (k > 0) {                                                          \
+        int parent = (k - 1) / D;                                            \
+        if (a[parent] <= val) break;                                         \
+        a[k] = a[parent];                                                    \
+        k = parent;                                                          \
+    }                                                                        \
+    a[k] = val;                                                              \
+}                                                                            \
+static int dheap##D##RemoveMin(SlotHeap *h) {                                \
+    int *a = h->arr + (D - 1);                                               \
+    int ret = a[0];                                                          \
+    int n = --h->size;                                                       \
+    int val = a[n];                                                          \
+    a[n] = HEAP_EMPTY;                                                       \
+    if (n == 0) return ret;                                                  \
+    int k = 0;                                                               \
+    while (1) {                                                              \
+        int c = D * k + 1;                                                   \
+        if (c >= n) break;                                                   \
+        const int *g = a + c;                                                \
+        int best = g[0], bi = 0;                                             \
+        for (int j = 1; j < D; j++) {                                        \
+            int lt = g[j] < best;                                            \
+            best = lt ? g[j] : best;                                         \
+            bi = lt ? j : bi;                                                \
+        }                                                                    \
+        if (val <= best) break;                                              \
+        a[k] = best;                                                         \
+        k = c + bi;                                                          \
+    }                                                                        \
+    a[k] = val;                                                              \
+    return ret;                                                              \
+}
+
+DEFINE_DARY_HEAP(2)
+DEFINE_DARY_HEAP(4)
+DEFINE_DARY_HEAP(8)
+
+#define HEAP_FN_(d, op) dheap##d##op
+#define HEAP_FN(d, op) HEAP_FN_(d, op)
+
+void heapReset(SlotHeap *h) {
+    HEAP_FN(HEAP_ARITY, Reset)(h);
+}
+
+void heapInsert(SlotHeap *h, int val) {
+    if (h->size >= h->cap) return;
+    HEAP_FN(HEAP_ARITY, Insert)(h, val);
+}
+
+int heapRemoveMin(SlotHeap *h) {
+    if (h->size == 0) return -1;
+    return HEAP_FN(HEAP_ARITY, RemoveMin)(h);
+}
+
+/* The same d-ary layout over 64-bit keys, for allocation orders that are
+   not simply the slot number: the key carries the order in its high bits
+   and the slot in its low bits. */
+#define KEY_EMPTY UINT64_MAX
+
+typedef struct {
+    uint64_t *arr;      /* node k at arr[k + HEAP_ARITY - 1] */
+    int size;
+    int cap;
+} KeyHeap;
+
+void keyHeapReset(KeyHeap *h) {
+    for (int i = 0; i < HEAP_STORE_LEN(h->cap, HEAP_ARITY); i++) h->arr[i] = KEY_EMPTY;
+    h->size = 0;
+}
+
+void keyHeapInsert(KeyHeap *h, uint64_t key) {
+    if (h->size >= h->cap) return;
+    uint64_t *a = h->arr + (HEAP_ARITY - 1);
+    int k = h->size++;
+    while (k > 0) {
+        int parent = (k - 1) / HEAP_ARITY;
+        if (a[parent] <= key) break;
+        a[k] = a[parent];
+        k = parent;
+    }
+    a[k] = key;
+}
+
+uint64_t keyHeapRemoveMin(KeyHeap *h) {
+    if (h->size == 0) return KEY_EMPTY;
+    uint64_t *a = h->arr + (HEAP_ARITY - 1);
+    uint64_t ret = a[0];
+    int n = --h->size;
+    uint64_t key = a[n];
+    a[n] = KEY_EMPTY;
+    if (n == 0) return ret;
+    int k = 0;
+    while (1) {
+        int c = HEAP_ARITY * k + 1;
+        if (c >= n) break;
+        const uint64_t *g = a + c;
+        uint64_t best = g[0];
+        int bi = 0;
+        for (int j = 1; j < HEAP_ARITY; j++) {
+            int lt = g[j] < best;
+            best = lt ? g[j] : best;
+            bi = lt ? j : bi;
+        }
+        if (key <= best) break;
+        a[k] = best;
+        k = c + bi;
+    }
+    a[k] = key;
+    return ret;
+}
+
+/* ----- Waiting queue (circular) ----- */
+typedef struct {
+    int *q;             /* WAIT_CAP entries */
+    int front, rear, count;
+} WaitQueue;
+
+void resetWait(WaitQueue *w) {
+    w->front = 0; w->rear = -1; w->count = 0;
+}
+
+int enqueueWait(WaitQueue *w, int car) {
+    if (w->count == WAIT_CAP) return 0;
+    w->rear = (w->rear + 1) % WAIT_CAP;
+    w->q[w->rear] = car;
+    if (w->count == 0) w->front = w->rear;
+    w->count++;
+    return 1;
+}
+
+int dequeueWait(WaitQueue *w) {
+    if (w->count == 0) return -1;
+    int c = w->q[w->front];
+    w->front = (w->front + 1) % WAIT_CAP;
+    w->count--;
+    if (w->count == 0) resetWait(w);
+    return c;
+}
+
+/* ----- Large table allocation ----- */
+/* Big tables can be backed by 2 MB pages (--hugepages): explicit
+   MAP_HUGETLB pages first, then transparent huge pages via madvise, then
+   plain pages. Each region remembers what it got so startup can report it
+   and tableFree can release it the same way. */
+#define HUGE_PAGE (2u << 20)
+
+enum { PAGES_NORMAL, PAGES_THP, PAGES_HUGETLB };
+
+typedef struct {
+    void *p;
+    size_t bytes;
+    int pages;          /* PAGES_* */
+    int mapped;         /* 1: release with munmap, 0: with free */
+} Region;
+
+int useHugePages = 0;
+
+/* Heap allocations made so far. tableAlloc counts itself; building with
+   -DALLOC_CHECK on glibc also routes malloc and friends through here, so
+   --alloc-check can prove the warmed-up gate path never allocates. */
+_Atomic long allocCalls = 0;
+
+#if defined(ALLOC_CHECK) && defined(__GLIBC__)
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t k, size_t n);
+extern void *__libc_realloc(void *p, size_t n);
+extern void *__libc_memalign(size_t align, size_t n);
+
+void *malloc(size_t n) {
+    atomic_fetch_add_explicit(&allocCalls, 1, memory_order_relaxed);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t k, size_t n) {
+    atomic_fetch_add_explicit(&allocCalls, 1, memory_order_relaxed);
+    return __libc_calloc(k, n);
+}
+
+void *realloc(void *p, size_t n) {
+    atomic_fetch_add_explicit(&allocCalls, 1, memory_order_relaxed);
+    return __libc_realloc(p, n);
+}
+
+int posix_memalign(void **out, size_t align, size_t n) {
+    atomic_fetch_add_explicit(&allocCalls, 1, memory_order_relaxed);
+    *out = __libc_memalign(align, n);
+    return *out ? 0 : ENOMEM;
+}
+#endif
+
+void *tableAlloc(Region *r, size_t bytes) {
+    atomic_fetch_add_explicit(&allocCalls, 1, memory_order_relaxed);
+    r->p = NULL;
+    r->bytes = bytes;
+    r->pages = PAGES_NORMAL;
+    r->mapped = 0;
+    if (useHugePages) {
+        size_t len = (bytes + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+        void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            r->p = p; r->bytes = len; r->pages = PAGES_HUGETLB; r->mapped = 1;
+            return p;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+        /* over-allocate so the region can start on a 2 MB boundary */
+        char *raw = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *p = (char *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+            if (p > raw) munmap(raw, p - raw);
+            munmap(p + len, raw + HUGE_PAGE - p);
+            r->p = p; r->bytes = len; r->mapped = 1;
+            r->pages = madvise(p, len, MADV_HUGEPAGE) == 0 ? PAGES_THP : PAGES_NORMAL;
+            return p;
+        }
+#endif
+    }
+    if (posix_memalign(&r->p, CACHE_LINE, bytes)) r->p = NULL;
+    return r->p;
+}
+
+void tableFree(Region *r) {
+    if (!r->p) return;
+    if (r->mapped) munmap(r->p, r->bytes);
+    else free(r->p);
+    r->p = NULL;
+}
+
+const char *pagesName(int pages) {
+    return pages == PAGES_HUGETLB ? "2MB hugetlb" : pages == PAGES_THP ? "transparent huge" : "normal";
+}
+
+/* ----- Parking data structures ----- */
+/* Table sizes default to MAX_SLOTS / MAX_CARS and can be raised with
+   --slots / --cars; the tables are allocated once in initSystem. */
+int numSlots = MAX_SLOTS;
+int numCars = MAX_CARS;
+
+/* Per-car state is split by access pattern. CarHot holds what entry and
+   exit read and write and is aligned so each record sits in one cache
+   line. CarCold holds registration data that entry never touches, and
+   the car's newest closed stay, which only exit writes and only late
+   corrections read. */
+typedef struct {
+    struct Node *session;  /* open history record while parked */
+    int32_t slot;          /* 1..numSlots, -1 not present, -2 waiting, -3 holding an offer */
+    int32_t entryRel;      /* entry time relative to slotEpoch */
+    uint32_t flags;        /* CAR_F_* */
+    int32_t stayPos;       /* position in its overstay heap, -1 if none */
+    int32_t offer;         /* slot held for it while slot is -3, else 0 */
+    int32_t waitZone;      /* zone whose queue it is in while slot is -2 */
+} __attribute__((aligned(32))) CarHot;
+
+#define CAR_F_PASS 1u      /* monthly pass: no charge */
+#define CAR_F_OVERSTAY 2u  /* past --overstay: in stayFlagged, not stayWatch */
+
+typedef struct {
+    char plate[16];
+    char account[24];      /* billing account, empty if none */
+    time_t passSince;      /* when the monthly pass was registered */
+    struct Node *lastStay; /* newest closed stay still in the history ring, NULL if none */
+} CarCold;
+
+CarHot *carHot;
+CarCold *carCold;
+
+/* Packed per-slot state: everything occupancy and dwell scans need sits in
+   one dense 8-byte entry. The top byte of the car word holds SLOT_F_* flags,
+   leaving 24 bits for the car handle. A free slot is exactly
+   { SLOT_FREE, 0 } so it can be matched as a single 64-bit word. */
+typedef struct {
+    uint32_t car;      /* car id | flags, SLOT_FREE if empty */
+    int32_t entryRel;  /* entry time in seconds relative to slotEpoch */
+} SlotState;
+
+#define SLOT_FREE 0xFFFFFFFFu
+#define SLOT_FREE_BITS 0x00000000FFFFFFFFull  /* { SLOT_FREE, 0 } on little-endian */
+#define SLOT_CAR_MASK 0x00FFFFFFu
+#define SLOT_F_PASS (1u << 24)                 /* parked on a monthly pass */
+#define SLOT_F_HELD (1u << 25)                 /* held for an offered car; entryRel is the offer time */
+
+SlotState *slotState;           /* slot -> state, index 0 unused */
+time_t slotEpoch;
+
+int slotCar(int s) {
+    return slotState[s].car == SLOT_FREE ? -1 : (int)(slotState[s].car & SLOT_CAR_MASK);
+}
+
+time_t slotEntryTime(int s) {
+    return slotEpoch + slotState[s].entryRel;
+}
+
+void slotOccupy(int s, int car, time_t entry) {
+    slotState[s].car = (uint32_t)car | ((carHot[car].flags & CAR_F_PASS) ? SLOT_F_PASS : 0);
+    slotState[s].entryRel = (int32_t)(entry - slotEpoch);
+}
+
+void slotHold(int s, int car, time_t offered) {
+    slotState[s].car = (uint32_t)car | SLOT_F_HELD;
+    slotState[s].entryRel = (int32_t)(offered - slotEpoch);
+}
+
+static inline int slotHeld(int s) {
+    return slotState[s].car != SLOT_FREE && (slotState[s].car & SLOT_F_HELD);
+}
+
+void slotRelease(int s) {
+    slotState[s].car = SLOT_FREE;
+    slotState[s].entryRel = 0;
+}
+
+/* Per-slot wear counters, kept apart from SlotState so the packed entry
+   stays 8 bytes, and 8 bytes themselves so the exit's extra miss stays a
+   single line. Updated once per exit; an open stay is not counted until
+   it ends. */
+typedef struct {
+    uint32_t busySecs;      /* occupied seconds over closed stays, saturating */
+    uint32_t sessions;      /* closed stays */
+} SlotUse;
+
+SlotUse *slotUse;               /* slot -> counters, index 0 unused */
+time_t useSince;                /* when the counters started */
+
+/* slot -> end of its last stay relative to slotEpoch, INT32_MIN if it
+   has had none. Each new stay records it, and a late correction never
+   starts a stay before it, so stays on one slot cannot overlap. */
+int32_t *slotFreed;
+
+void slotUseAdd(int s, long secs) {
+    SlotUse *u = &slotUse[s];
+    uint64_t b = (uint64_t) u->busySecs + (secs > 0 ? (uint64_t) secs : 0);
+    u->busySecs = b < UINT32_MAX ? (uint32_t) b : UINT32_MAX;
+    u->sessions++;
+}
+
+typedef struct Node {
+    int car;
+    int slot;
+    int fee;          /* charged at exit, 0 while parked */
+    int32_t slotFree; /* end of the slot's previous stay (rel. slotEpoch), INT32_MIN if none */
+    time_t entryTime;
+    time_t exitTime; /* 0 if still parked */
+    uint64_t exitSeq; /* eventSeq of the exit, 0 if still parked, HIST_WRITING mid-correction */
+    uint64_t id;      /* allocation number, 1-based, never reused */
+    struct Node *next;
+} Node;
+
+Node *history = NULL;
+
+#define HIST_WRITING UINT64_MAX     /* exitSeq while a published stay is rewritten */
+
+/* History is a fixed ring of nodes carved out of 2 MB segments, all
+   allocated at startup (--history N records, rounded up to whole
+   segments). Once the ring is full the oldest record is recycled for the
+   newest, so the gate path never allocates. A stay still open when its
+   turn comes is not dropped but moved to the newest end; the ring holds
+   at least twice as many records as slots, so a closed one always
+   follows within numSlots steps. */
+typedef struct HistSeg {
+    struct HistSeg *next;
+    Region region;
+    int used;           /* nodes holding a record */
+    Node nodes[];
+} HistSeg;
+
+#define HIST_SEG_NODES ((int)((HUGE_PAGE - sizeof(HistSeg)) / sizeof(Node)))
+
+HistSeg *histSegs = NULL;   /* all segments, in ring order */
+HistSeg *histCur = NULL;    /* segment new nodes come from */
+int histPos = 0;            /* next node in histCur */
+long histWanted = 0;        /* --history, 0: 4 records per slot */
+long histCap = 0;           /* ring capacity in nodes */
+_Atomic uint64_t histAllocated = 0;  /* id of the newest node */
+int histPages = PAGES_NORMAL;
+int totalRevenue = 0;
+int64_t histDropped = 0;    /* fees of closed stays recycled out of the ring */
+
+/* ----- Free-slot scan (vectorized) ----- */
+/* Counts the free entries of st[first..last] and, if out is not NULL,
+   writes their slot numbers to out in ascending order. Free entries are
+   matched as whole 64-bit words: AVX2 checks 8 slots per iteration,
+   SSE4.1/NEON 2, with a scalar tail. */
+typedef int (*FreeScanFn)(const SlotState *st, int first, int last, int *out);
+
+int freeScanScalar(const SlotState *st, int first, int last, int *out) {
+    int n = 0;
+    for (int s = first; s <= last; s++) {
+        if (out) out[n] = s;
+        n += st[s].car == SLOT_FREE;
+    }
+    return n;
+}
+
+#define EMIT_FREE_MASK(mask, base)                          \
+    do {                                                    \
+        unsigned m_ = (mask);                               \
+        if (out) {                                          \
+            while (m_) {                                    \
+                out[n++] = (base) + __builtin_ctz(m_);      \
+                m_ &= m_ - 1;                               \
+            }                                               \
+        } else {                                            \
+            n += __builtin_popcount(m_);                    \
+        }                                                   \
+    } while (0)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse4.1")))
+int freeScanSSE(const SlotState *st, int first, int last, int *out) {
+    int n = 0, s = first;
+    const __m128i empty = _mm_set1_epi64x((long long)SLOT_FREE_BITS);
+    for (; s + 2 <= last + 1; s += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(st + s));
+        EMIT_FREE_MASK(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, empty))), s);
+    }
+    return n + freeScanScalar(st, s, last, out ? out + n : NULL);
+}
+
+__attribute__((target("avx2")))
+int freeScanAVX2(const SlotState *st, int first, int last, int *out) {
+    int n = 0, s = first;
+    const __m256i empty = _mm256_set1_epi64x((long long)SLOT_FREE_BITS);
+    for (; s + 8 <= last + 1; s += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(st + s));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(st + s + 4));
+        unsigned ma = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, empty)));
+        unsigned mb = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(b, empty)));
+        EMIT_FREE_MASK(ma | mb << 4, s);
+    }
+    return n + freeScanScalar(st, s, last, out ? out + n : NULL);
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+int freeScanNEON(const SlotState *st, int first, int last, int *out) {
+    int n = 0, s = first;
+    const uint64x2_t empty = vdupq_n_u64(SLOT_FREE_BITS);
+    for (; s + 2 <= last + 1; s += 2) {
+        uint64x2_t eq = vceqq_u64(vld1q_u64((const uint64_t *)(st + s)), empty);
+        EMIT_FREE_MASK((unsigned)(vgetq_lane_u64(eq, 0) & 1) | (unsigned)(vgetq_lane_u64(eq, 1) & 2), s);
+    }
+    return n + freeScanScalar(st, s, last, out ? out + n : NULL);
+}
+#endif
+
+FreeScanFn pickFreeScan() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return freeScanAVX2;
+    if (__builtin_cpu_supports("sse4.1")) return freeScanSSE;
+    return freeScanScalar;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    return freeScanNEON;
+#else
+    return freeScanScalar;
+#endif
+}
+
+FreeScanFn freeScan = freeScanScalar;
+
+int countFreeSlots() {
+    return freeScan(slotState, 1, numSlots, NULL);
+}
+
+/* ----- Zones (shards of the slot space) ----- */
+/* Slots are split into --zones contiguous ranges. Each zone has its own
+   free-slot heap and waiting queue. The heap, the queue and the zone's
+   slice of slotState are first touched by a worker thread pinned to the
+   zone's CPU, so on a multi-socket box the memory lands on that
+   worker's NUMA node. Placement comes from /sys or from a --topology
+   file. With placement on, each gate event is then run by the worker of
+   the zone it touches, so zone state is only used from its own node. On
+   a single-node machine nothing is pinned and events run inline on the
+   gate thread. */
+#define MAX_ZONES 64
+#define MAX_CPUS 1024
+#define SLOTS_PER_PAGE (4096 / (int)sizeof(SlotState))
+
+/* Allocation order for a zone's free slots, chosen per zone (--alloc,
+   batch "policy", menu 19) and switchable between events:
+     lowest       the slot heap, lowest number first
+     round-robin  the next free slot after the last one handed out,
+                  wrapping; a key heap on (lap, offset)
+     lru          the slot freed longest ago; a FIFO ring of releases
+     least-used   fewest busy seconds so far, ties to the lower slot; a
+                  key heap on (busy, offset)
+   All allocate and release in O(1) or O(log n). */
+enum { ALLOC_LOWEST, ALLOC_ROUND_ROBIN, ALLOC_LRU, ALLOC_LEAST_USED, ALLOC_POLICIES };
+
+const char *allocPolicyName[ALLOC_POLICIES] = { "lowest", "round-robin", "lru", "least-used" };
+
+#define KEY_SLOT_BITS 24            /* slot offset in a zone's free key */
+
+typedef struct {
+    int *q;
+    int head, count, cap;
+} SlotRing;
+
+typedef struct {
+    int first, last;    /* slot range */
+    int policy;         /* ALLOC_* */
+    SlotHeap heap;      /* free slots under lowest; rebuild scratch */
+    KeyHeap keyed;      /* free slots under round-robin and least-used */
+    SlotRing ring;      /* free slots under lru, oldest release first */
+    uint64_t lap;       /* round-robin: passes over the zone so far */
+    int cursor;         /* round-robin: offset after the last slot taken */
+    WaitQueue wait;
+    int node, cpu;      /* placement, -1 if unset */
+    int ok;             /* tables allocated */
+    Region heapRegion, keyRegion, ringRegion, queueRegion;
+} __attribute__((aligned(CACHE_LINE))) Zone;
+
+Zone zones[MAX_ZONES];
+int allocPolicy[MAX_ZONES];     /* starting policy per zone */
+int numZones = 1;
+int zoneSpan;           /* slots per zone (the last one may be shorter) */
+
+int numaNodes = 1;
+int numCpus = 0;
+short cpuNode[MAX_CPUS];
+int pinZones = 0;       /* set when there is more than one node or a topology file */
+
+Zone *zoneOfSlot(int s) {
+    return &zones[(s - 1) / zoneSpan];
+}
+
+/* a car parks in its home zone, or the next zone round with a free
+   slot; with none free it waits in the first of those queues with room */
+Zone *homeZone(int car) {
+    return &zones[car % numZones];
+}
+
+/* parses a sysfs cpulist such as "0-3,8-11" */
+void markCpuList(const char *list, int node) {
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long a = strtol(p, &end, 10), b = a;
+        if (end == p) break;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long c = a; c <= b && c < MAX_CPUS; c++) {
+            cpuNode[c] = (short)node;
+            if (c + 1 > numCpus) numCpus = (int)c + 1;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (*p == '\n') break;
+    }
+}
+
+void detectTopology() {
+    for (int z = 0; z < MAX_ZONES; z++) zones[z].node = zones[z].cpu = -1;
+    for (int c = 0; c < MAX_CPUS; c++) cpuNode[c] = -1;
+    numaNodes = 0;
+    for (int n = 0; n < MAX_CPUS; n++) {
+        char path[64], line[1024];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE *f = fopen(path, "r");
+        if (!f) break;
+        if (fgets(line, sizeof(line), f)) markCpuList(line, n);
+        fclose(f);
+        numaNodes = n + 1;
+    }
+    if (numaNodes == 0) numaNodes = 1;
+    if (numCpus == 0) {
+        /* no sysfs node list: every CPU on node 0 */
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+        numCpus = n < 1 ? 1 : n > MAX_CPUS ? MAX_CPUS : (int)n;
+        for (int c = 0; c < numCpus; c++) cpuNode[c] = 0;
+    }
+    pinZones = numaNodes > 1;
+}
+
+/* k-th CPU (wrapping) that belongs to node */
+int nodeCpu(int node, int k) {
+    int count = 0;
+    for (int c = 0; c < numCpus; c++) count += cpuNode[c] == node;
+    if (count == 0) return -1;
+    k %= count;
+    for (int c = 0; c < numCpus; c++) if (cpuNode[c] == node && k-- == 0) return c;
+    return -1;
+}
+
+/* Topology file, one line per zone:
+       zone <z> node <n> [cpu <c>]
+       zone <z> cpu <c>
+   '#' starts a comment. Zones not listed get the default placement. */
+int loadTopology(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[128];
+    int lineNo = 0, ok = 1;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        char *hash = strchr(line, '#'); if (hash) *hash = '\0';
+        int z, node = -1, cpu = -1, fields, cpuOnly = 0;
+        if ((fields = sscanf(line, " zone %d node %d cpu %d", &z, &node, &cpu)) >= 2) {}
+        else if (sscanf(line, " zone %d cpu %d", &z, &cpu) == 2) fields = 3, cpuOnly = 1;
+        else {
+            if (strspn(line, " \t\r\n") != strlen(line)) {
+                fprintf(stderr, "%s:%d: expected 'zone <z> node <n> [cpu <c>]'\n", path, lineNo);
+                ok = 0;
+            }
+            continue;
+        }
+        if (z < 0 || z >= MAX_ZONES) { fprintf(stderr, "%s:%d: bad zone\n", path, lineNo); ok = 0; continue; }
+        if (fields == 3 && (cpu < 0 || cpu >= numCpus)) { fprintf(stderr, "%s:%d: bad cpu\n", path, lineNo); ok = 0; continue; }
+        if (cpuOnly) node = cpuNode[cpu] >= 0 ? cpuNode[cpu] : 0;
+        if (node < 0 || node >= numaNodes) { fprintf(stderr, "%s:%d: bad node\n", path, lineNo); ok = 0; continue; }
+        zones[z].node = node;
+        zones[z].cpu = fields == 3 ? cpu : nodeCpu(node, 0);
+    }
+    fclose(f);
+    pinZones = 1;
+    return ok;
+}
+
+void placeZones() {
+    int perNode[MAX_ZONES] = { 0 };
+    for (int z = 0; z < numZones; z++) {
+        Zone *zn = &zones[z];
+        if (zn->node < 0) zn->node = z % numaNodes;
+        if (zn->cpu < 0 && pinZones) zn->cpu = nodeCpu(zn->node, perNode[zn->node % MAX_ZONES]++);
+    }
+}
+
+void pinToCpu(int cpu) {
+#ifdef __linux__
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+typedef void (*ZoneFn)(Zone *z, void *arg);
+
+/* Each zone has one long-lived worker. It sleeps until handed a job,
+   pins itself to the zone's CPU (when placement is on) and runs it, so
+   the zone's tables are first touched there and, with pinZones, every
+   gate event on the zone runs there too. Jobs are handed over one at a
+   time and the caller waits, so the gate stays single-writer. */
+enum { ZX_IDLE, ZX_POSTED, ZX_DONE };
+#define ZONE_SPIN 4096      /* polls before a worker sleeps or a caller yields */
+int zoneSpin = -1;          /* ZONE_SPIN, or 0 with one CPU online */
+
+typedef struct {
+    _Atomic int state;      /* ZX_* */
+    _Atomic int sleeping;   /* worker is (about to be) in pthread_cond_wait */
+    ZoneFn fn;
+    void *arg;
+    int started, failed;
+    int pinned;             /* cpu it is pinned to, -1 if none */
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} __attribute__((aligned(CACHE_LINE))) ZoneExec;
+
+ZoneExec zoneExec[MAX_ZONES];
+
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+void *zoneWorkerMain(void *p) {
+    ZoneExec *x = p;
+    Zone *zn = &zones[x - zoneExec];
+    for (;;) {
+        for (int spin = 0; atomic_load_explicit(&x->state, memory_order_acquire) != ZX_POSTED; spin++) {
+            if (spin < zoneSpin) { cpuRelax(); continue; }
+            pthread_mutex_lock(&x->lock);
+            atomic_store(&x->sleeping, 1);
+            while (atomic_load(&x->state) != ZX_POSTED) pthread_cond_wait(&x->wake, &x->lock);
+            atomic_store(&x->sleeping, 0);
+            pthread_mutex_unlock(&x->lock);
+        }
+        if (pinZones && zn->cpu != x->pinned) {
+            pinToCpu(zn->cpu);
+            x->pinned = zn->cpu;
+        }
+        x->fn(zn, x->arg);
+        atomic_store_explicit(&x->state, ZX_DONE, memory_order_release);
+    }
+    return NULL;
+}
+
+/* starts zone z's worker on first use; 0 if it cannot run */
+static int zoneExecStart(ZoneExec *x) {
+    if (x->started || x->failed) return x->started;
+    if (zoneSpin < 0) zoneSpin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? ZONE_SPIN : 0;
+    pthread_mutex_init(&x->lock, NULL);
+    pthread_cond_init(&x->wake, NULL);
+    x->pinned = -1;
+    atomic_store(&x->state, ZX_IDLE);
+    x->started = pthread_create(&x->tid, NULL, zoneWorkerMain, x) == 0;
+    x->failed = !x->started;
+    if (x->started) pthread_detach(x->tid);
+    return x->started;
+}
+
+static void zonePost(ZoneExec *x, ZoneFn fn, void *arg) {
+    x->fn = fn;
+    x->arg = arg;
+    atomic_store(&x->state, ZX_POSTED);
+    if (atomic_load(&x->sleeping)) {
+        pthread_mutex_lock(&x->lock);
+        pthread_cond_signal(&x->wake);
+        pthread_mutex_unlock(&x->lock);
+    }
+}
+
+static void zoneWait(ZoneExec *x) {
+    for (int spin = 0; atomic_load_explicit(&x->state, memory_order_acquire) != ZX_DONE; spin++)
+        if (spin < zoneSpin) cpuRelax();
+        else sched_yield();
+    atomic_store_explicit(&x->state, ZX_IDLE, memory_order_relaxed);
+}
+
+/* runs fn on zn's worker and waits for it (inline if there is none) */
+void zoneCall(Zone *zn, ZoneFn fn, void *arg) {
+    ZoneExec *x = &zoneExec[zn - zones];
+    if (!zoneExecStart(x)) { fn(zn, arg); return; }
+    zonePost(x, fn, arg);
+    zoneWait(x);
+}
+
+/* runs fn once per zone, all zones' workers at once */
+void zonesRunOnWorkers(ZoneFn fn, void *arg) {
+    for (int z = 0; z < numZones; z++)
+        if (zoneExecStart(&zoneExec[z])) zonePost(&zoneExec[z], fn, arg);
+        else fn(&zones[z], arg);
+    for (int z = 0; z < numZones; z++) if (zoneExec[z].started) zoneWait(&zoneExec[z]);
+}
+
+/* Splits 1..numSlots into zones; when zones are large their boundaries
+   are rounded to a page of slot state so no page is shared. */
+void layoutZones() {
+    if (numZones > numSlots) numZones = numSlots;
+    zoneSpan = (numSlots + numZones - 1) / numZones;
+    if (zoneSpan >= SLOTS_PER_PAGE) zoneSpan = (zoneSpan + SLOTS_PER_PAGE - 1) / SLOTS_PER_PAGE * SLOTS_PER_PAGE;
+    numZones = (numSlots + zoneSpan - 1) / zoneSpan;
+    for (int z = 0; z < numZones; z++) {
+        zones[z].first = z * zoneSpan + 1;
+        zones[z].last = z == numZones - 1 ? numSlots : (z + 1) * zoneSpan;
+    }
+}
+
+/* A keyed free slot sorts by the policy's key and carries its offset in
+   the low bits. Round-robin puts offsets before the cursor in the next
+   lap, so the minimum is the first free slot at or after the cursor. */
+static inline uint64_t freeKey(const Zone *z, int s) {
+    uint64_t off = (uint64_t)(s - z->first);
+    if (z->policy == ALLOC_ROUND_ROBIN) return (z->lap + (off < (uint64_t) z->cursor)) << KEY_SLOT_BITS | off;
+    return (uint64_t) slotUse[s].busySecs << KEY_SLOT_BITS | off;
+}
+
+static inline int policyKeyed(int policy) {
+    return policy == ALLOC_ROUND_ROBIN || policy == ALLOC_LEAST_USED;
+}
+
+static inline void ringPush(SlotRing *r, int s) {
+    int i = r->head + r->count++;
+    r->q[i < r->cap ? i : i - r->cap] = s;
+}
+
+static inline int ringPop(SlotRing *r) {
+    if (r->count == 0) return -1;
+    int s = r->q[r->head];
+    r->head = r->head + 1 < r->cap ? r->head + 1 : 0;
+    r->count--;
+    return s;
+}
+
+/* A sorted free list is already a valid min-heap for any arity, so the
+   heap is rebuilt in O(n) straight from the scan. Other policies then
+   take the scan, in slot order, into their own store and leave the slot
+   heap empty. */
+void heapRebuild(Zone *z) {
+    int *a = z->heap.arr + HEAP_ARITY - 1;
+    heapReset(&z->heap);
+    z->heap.size = freeScan(slotState, z->first, z->last, a);
+    /* the scalar scan stores one candidate past the count */
+    if (z->heap.size < z->heap.cap) a[z->heap.size] = HEAP_EMPTY;
+    z->keyed.size = 0;
+    z->ring.head = z->ring.count = 0;
+    if (z->policy == ALLOC_LOWEST) return;
+    if (z->policy == ALLOC_LRU) for (int k = 0; k < z->heap.size; k++) ringPush(&z->ring, a[k]);
+    else {
+        keyHeapReset(&z->keyed);
+        for (int k = 0; k < z->heap.size; k++) keyHeapInsert(&z->keyed, freeKey(z, a[k]));
+    }
+    heapReset(&z->heap);
+}
+
+void zoneReset(Zone *z) {
+    for (int s = z->first; s <= z->last; s++) slotRelease(s);
+    heapRebuild(z);
+    resetWait(&z->wait);
+}
+
+/* next free slot by the zone's policy, -1 if none */
+static inline int zoneTake(Zone *z) {
+    if (z->policy == ALLOC_LOWEST) return heapRemoveMin(&z->heap);
+    if (z->policy == ALLOC_LRU) return ringPop(&z->ring);
+    uint64_t key = keyHeapRemoveMin(&z->keyed);
+    if (key == KEY_EMPTY) return -1;
+    int off = (int)(key & ((1u << KEY_SLOT_BITS) - 1));
+    if (z->policy == ALLOC_ROUND_ROBIN) {
+        z->lap = key >> KEY_SLOT_BITS;
+        z->cursor = off + 1;
+    }
+    return z->first + off;
+}
+
+static inline void zoneGive(Zone *z, int s) {
+    if (z->policy == ALLOC_LOWEST) heapInsert(&z->heap, s);
+    else if (z->policy == ALLOC_LRU) ringPush(&z->ring, s);
+    else keyHeapInsert(&z->keyed, freeKey(z, s));
+}
+
+static inline int zoneFreeCount(const Zone *z) {
+    return z->policy == ALLOC_LOWEST ? z->heap.size : z->policy == ALLOC_LRU ? z->ring.count : z->keyed.size;
+}
+
+/* Switches a zone to another policy between events: the store it needs
+   is allocated on first use and the free slots are rebuilt into it in
+   O(n). 0 if the store cannot be had. */
+int zoneSetPolicy(Zone *z, int policy) {
+    int n = z->last - z->first + 1;
+    if (policyKeyed(policy) && !z->keyed.arr) {
+        if (n > 1 << KEY_SLOT_BITS) return 0;
+        z->keyed.arr = tableAlloc(&z->keyRegion, HEAP_STORE_LEN(n, HEAP_ARITY) * sizeof(uint64_t));
+        if (!z->keyed.arr) return 0;
+        z->keyed.cap = n;
+    }
+    if (policy == ALLOC_LRU && !z->ring.q) {
+        z->ring.q = tableAlloc(&z->ringRegion, n * sizeof(int));
+        if (!z->ring.q) return 0;
+        z->ring.cap = n;
+    }
+    z->policy = policy;
+    heapRebuild(z);
+    return 1;
+}
+
+/* worker side of allocTables: allocate and first-touch zone state */
+void zoneAlloc(Zone *z, void *arg) {
+    (void)arg;
+    int n = z->last - z->first + 1;
+    z->heap.arr = tableAlloc(&z->heapRegion, HEAP_STORE_LEN(n, HEAP_ARITY) * sizeof(int));
+    z->heap.cap = n;
+    z->policy = ALLOC_LOWEST;
+    z->lap = 0;
+    z->cursor = 0;
+    z->wait.q = tableAlloc(&z->queueRegion, WAIT_CAP * sizeof(int));
+    z->ok = z->heap.arr && z->wait.q;
+    if (z->ok) {
+        for (int s = z->first; s <= z->last; s++) slotRelease(s);
+        z->ok = zoneSetPolicy(z, allocPolicy[z - zones]);
+        resetWait(&z->wait);
+    }
+}
+
+void zoneFree(Zone *z, void *arg) {
+    (void)arg;
+    tableFree(&z->heapRegion);
+    tableFree(&z->keyRegion);
+    tableFree(&z->ringRegion);
+    tableFree(&z->queueRegion);
+    z->heap.arr = NULL;
+    z->keyed.arr = NULL;
+    z->keyed.size = 0;
+    z->ring.q = NULL;
+    z->ring.count = 0;
+    z->wait.q = NULL;
+    z->ok = 0;
+}
+
+void reportZones() {
+    printf("Zones: %d over %d NUMA node%s%s\n", numZones, numaNodes, numaNodes == 1 ? "" : "s",
+           pinZones ? "" : " (single node: threads not pinned)");
+    if (!pinZones) return;
+    for (int z = 0; z < numZones; z++)
+        printf("  zone %d: slots %d-%d, node %d, cpu %d\n", z, zones[z].first, zones[z].last,
+               zones[z].node, zones[z].cpu);
+}
+
+/* ----- Utilities ----- */
+int histAlloc() {
+    long want = histWanted > 0 ? histWanted : 4L * numSlots;
+    if (want < 2L * numSlots) want = 2L * numSlots;
+    int segs = (int)((want + HIST_SEG_NODES - 1) / HIST_SEG_NODES);
+    HistSeg **tail = &histSegs;
+    for (int i = 0; i < segs; i++) {
+        Region r;
+        HistSeg *seg = tableAlloc(&r, sizeof(HistSeg) + HIST_SEG_NODES * sizeof(Node));
+        if (!seg) return 0;
+        seg->next = NULL;
+        seg->region = r;
+        seg->used = 0;
+        histPages = r.pages;
+        *tail = seg;
+        tail = &seg->next;
+    }
+    histCap = (long) segs * HIST_SEG_NODES;
+    return 1;
+}
+
+Node *histAllocNode() {
+    for (;;) {
+        if (histPos == HIST_SEG_NODES) {
+            histCur = histCur->next ? histCur->next : histSegs;
+            histPos = 0;
+        }
+        Node *n = &histCur->nodes[histPos++];
+        if (histCur->used < histPos) histCur->used = histPos;
+        uint64_t id = atomic_load_explicit(&histAllocated, memory_order_relaxed) + 1;
+        atomic_store_explicit(&histAllocated, id, memory_order_relaxed);
+        if (id <= (uint64_t) histCap) {
+            n->id = id;
+            return n;
+        }
+        /* n holds the oldest record; snapshot readers see the bumped
+           histAllocated before any of n changes (see snapHistRead) */
+        atomic_thread_fence(memory_order_release);
+        Node *newer = histPos < HIST_SEG_NODES ? &histCur->nodes[histPos]
+                    : &(histCur->next ? histCur->next : histSegs)->nodes[0];
+        newer->next = NULL;
+        n->id = id;
+        if (carHot[n->car].session != n) {
+            histDropped += n->fee;
+            if (carCold[n->car].lastStay == n) carCold[n->car].lastStay = NULL;
+            return n;
+        }
+        /* still parked: the same node becomes the newest record */
+        n->next = history;
+        history = n;
+    }
+}
+
+void histReset() {
+    for (HistSeg *seg = histSegs; seg; seg = seg->next) seg->used = 0;
+    histCur = histSegs;
+    histPos = 0;
+    atomic_store(&histAllocated, 0);
+    histDropped = 0;
+    history = NULL;
+}
+
+void histFree() {
+    while (histSegs) {
+        HistSeg *seg = histSegs;
+        histSegs = seg->next;
+        Region r = seg->region;
+        tableFree(&r);
+    }
+    histCur = NULL;
+    histCap = 0;
+    history = NULL;
+}
+
+Node *addHistoryNode(int car, int slot, time_t entry, time_t exitT) {
+    Node *n = histAllocNode();
+    if (!n) return NULL;
+    n->car = car; n->slot = slot; n->fee = 0; n->entryTime = entry; n->exitTime = exitT;
+    n->slotFree = slotFreed[slot];
+    n->exitSeq = 0;
+    n->next = history;
+    history = n;
+    return n;
+}
+
+void format_time(time_t t, char *buf, size_t bufsz) {
+    struct tm tmst;
+    localtime_r(&t, &tmst);
+    strftime(buf, bufsz, "%Y-%m-%d %H:%M:%S", &tmst);
+}
+
+/* safer input helpers */
+int read_int(const char *prompt, int *out) {
+    char line[128];
+    if (prompt) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+    if (!fgets(line, sizeof(line), stdin)) return 0;
+    char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
+    int tmp;
+    if (sscanf(line, "%d", &tmp) != 1) return 0;
+    *out = tmp;
+    return 1;
+}
+
+int read_char(const char *prompt, char *out) {
+    char line[32];
+    if (prompt) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+    if (!fgets(line, sizeof(line), stdin)) return 0;
+    *out = line[0];
+    return 1;
+}
+
+int read_str(const char *prompt, char *out, size_t outsz) {
+    if (prompt) {
+        printf("%s", prompt);
+        fflush(stdout);
+    }
+    if (!fgets(out, (int) outsz, stdin)) return 0;
+    char *nl = strchr(out, '\n'); if (nl) *nl = '\0';
+    return out[0] != '\0';
+}
+
+uint64_t xorshift64(uint64_t *s) {
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+double monoSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Gate time comes from clockNow(): the wall clock, or a virtual clock
+   that only moves when set (batch mode, replay). */
+int clockVirtual = 0;
+time_t clockValue = 0;
+
+time_t clockNow() {
+    return clockVirtual ? clockValue : time(NULL);
+}
+
+void clockSet(time_t t) {
+    clockVirtual = 1;
+    clockValue = t;
+}
+
+/* ----- Timers (hierarchical timing wheel) ----- */
+/* One-second resolution on clockNow() time. Four levels of 256 slots
+   cover 2^32 s; later deadlines wait on an overflow list. A timer sits
+   at the lowest level whose block it shares with wheelTime, so level 0
+   holds the current 256 s and each level-l slot is cascaded down when
+   wheelTime reaches its start. Slots are intrusive doubly linked lists
+   over a pool of Timer records, which makes add and cancel O(1); a busy
+   bitmap per level lets timerRun jump over empty stretches, so a long
+   "advance" costs per timer and per non-empty slot, not per second.
+   Lists are appended at the tail, so timers with the same deadline fire
+   in the order they were added. Handles carry a generation, so
+   cancelling a timer that has already fired or been reused does nothing. Callbacks run on the thread that
+   calls timerRun, with the virtual clock stepped to their deadline. */
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 4
+#define TW_WORDS (TW_SLOTS / 64)
+
+enum { TW_FREE = -1, TW_DUE = TW_LEVELS * TW_SLOTS, TW_OVERFLOW, TW_LISTS };
+
+typedef void (*TimerFn)(int32_t arg, time_t now);
+
+typedef struct {
+    int64_t when;
+    TimerFn fn;
+    int32_t arg;
+    int32_t next, prev;     /* list links, -1 ends */
+    int32_t list;           /* level * TW_SLOTS + slot, TW_DUE, TW_OVERFLOW or TW_FREE */
+    uint32_t gen;           /* bumped on every reuse */
+} Timer;
+
+Timer *timers;
+int timerCap;
+int timerFreeList = -1;
+long timersPending;
+int64_t wheelTime;              /* everything due by now has fired */
+int32_t twHead[TW_LISTS], twTail[TW_LISTS];
+uint64_t twBusy[TW_LEVELS][TW_WORDS];
+
+static void twPush(int list, int i) {
+    Timer *t = &timers[i];
+    t->list = list;
+    t->next = -1;
+    t->prev = twTail[list];
+    if (t->prev >= 0) timers[t->prev].next = i;
+    else twHead[list] = i;
+    twTail[list] = i;
+    if (list < TW_DUE) twBusy[list / TW_SLOTS][list % TW_SLOTS / 64] |= 1ull << (list % 64);
+}
+
+static void twUnlink(int i) {
+    Timer *t = &timers[i];
+    int list = t->list;
+    if (t->prev >= 0) timers[t->prev].next = t->next;
+    else twHead[list] = t->next;
+    if (t->next >= 0) timers[t->next].prev = t->prev;
+    else twTail[list] = t->prev;
+    if (twHead[list] < 0 && list < TW_DUE) twBusy[list / TW_SLOTS][list % TW_SLOTS / 64] &= ~(1ull << (list % 64));
+}
+
+/* the list a deadline belongs on, relative to wheelTime */
+static int twListFor(int64_t when) {
+    if (when <= wheelTime) return TW_DUE;
+    uint64_t diff = (uint64_t) when ^ (uint64_t) wheelTime;
+    for (int l = 0; l < TW_LEVELS; l++)
+        if (diff >> (TW_BITS * (l + 1)) == 0)
+            return l * TW_SLOTS + (int)(((uint64_t) when >> (TW_BITS * l)) & (TW_SLOTS - 1));
+    return TW_OVERFLOW;
+}
+
+/* first busy slot at level l from index from on, -1 if none */
+static int twFindBusy(int l, int from) {
+    for (int w = from / 64; w < TW_WORDS && from < TW_SLOTS; w++) {
+        uint64_t bits = twBusy[l][w] & (~0ull << (from % 64));
+        if (bits) return w * 64 + __builtin_ctzll(bits);
+        from = (w + 1) * 64;
+    }
+    return -1;
+}
+
+/* the next time something happens: a level-0 slot comes due, or a slot
+   further up (or the overflow list) has to be cascaded */
+static int64_t twNext() {
+    for (int l = 0; l < TW_LEVELS; l++) {
+        int shift = TW_BITS * l;
+        int i = twFindBusy(l, (int)((wheelTime >> shift) & (TW_SLOTS - 1)) + 1);
+        if (i >= 0) return (wheelTime >> (shift + TW_BITS) << (shift + TW_BITS)) + ((int64_t) i << shift);
+    }
+    if (twHead[TW_OVERFLOW] >= 0) return ((wheelTime >> (TW_BITS * TW_LEVELS)) + 1) << (TW_BITS * TW_LEVELS);
+    return INT64_MAX;
+}
+
+/* grows the pool; off the gate path as long as it was sized for it */
+static int timerGrow() {
+    int cap = timerCap ? 2 * timerCap : 1024;
+    Timer *t = realloc(timers, (size_t) cap * sizeof(Timer));
+    if (!t) return 0;
+    timers = t;
+    for (int i = cap - 1; i >= timerCap; i--) {
+        timers[i] = (Timer){ 0, NULL, 0, timerFreeList, -1, TW_FREE, 1 };
+        timerFreeList = i;
+    }
+    timerCap = cap;
+    return 1;
+}
+
+/* empties the wheel and makes room for at least cap timers */
+#define TIMER_SPARE 1024     /* pool reserved at startup */
+
+int timerReset(time_t now, int cap) {
+    while (timerCap < cap) if (!timerGrow()) return 0;
+    for (int i = 0; i < TW_LISTS; i++) twHead[i] = twTail[i] = -1;
+    memset(twBusy, 0, sizeof(twBusy));
+    timerFreeList = -1;
+    for (int i = timerCap - 1; i >= 0; i--) {
+        if (timers[i].list != TW_FREE) timers[i].gen++;
+        timers[i].list = TW_FREE;
+        timers[i].next = timerFreeList;
+        timerFreeList = i;
+    }
+    timersPending = 0;
+    wheelTime = now;
+    return 1;
+}
+
+void timerFree() {
+    free(timers);
+    timers = NULL;
+    timerCap = 0;
+    timerFreeList = -1;
+    timersPending = 0;
+}
+
+/* calls fn(arg, now) once the clock reaches when; returns a handle for
+   timerCancel, 0 if the pool cannot grow */
+uint64_t timerAdd(time_t when, TimerFn fn, int32_t arg) {
+    if (timerFreeList < 0 && !timerGrow()) return 0;
+    int i = timerFreeList;
+    Timer *t = &timers[i];
+    timerFreeList = t->next;
+    t->when = when;
+    t->fn = fn;
+    t->arg = arg;
+    twPush(twListFor(when), i);
+    timersPending++;
+    return (uint64_t) t->gen << 32 | (uint32_t) i;
+}
+
+static void timerRelease(int i) {
+    timers[i].list = TW_FREE;
+    timers[i].gen++;
+    timers[i].next = timerFreeList;
+    timerFreeList = i;
+    timersPending--;
+}
+
+int timerPending(uint64_t handle) {
+    uint32_t i = (uint32_t) handle;
+    return handle && i < (uint32_t) timerCap && timers[i].gen == (uint32_t)(handle >> 32) && timers[i].list != TW_FREE;
+}
+
+/* 1 if the timer was still pending */
+int timerCancel(uint64_t handle) {
+    if (!timerPending(handle)) return 0;
+    twUnlink((int)(uint32_t) handle);
+    timerRelease((int)(uint32_t) handle);
+    return 1;
+}
+
+/* fires everything due up to and including to, in deadline order, then
+   leaves the virtual clock at to. A callback gets the wheel's time, which
+   is its deadline unless it was added already overdue. */
+void timerRun(time_t to) {
+    for (;;) {
+        while (twHead[TW_DUE] >= 0) {
+            int i = twHead[TW_DUE];
+            Timer t = timers[i];
+            twUnlink(i);
+            timerRelease(i);
+            if (clockVirtual && wheelTime > clockValue) clockValue = (time_t) wheelTime;
+            t.fn(t.arg, (time_t) wheelTime);
+        }
+        int64_t next = twNext();
+        if (next > (int64_t) to) break;
+        wheelTime = next;
+        /* cascade every level whose slot starts here, top first */
+        for (int l = TW_LEVELS; l >= 1; l--) {
+            if (next & ((1ll << (TW_BITS * l)) - 1)) continue;
+            int list = l == TW_LEVELS ? TW_OVERFLOW : l * TW_SLOTS + (int)((next >> (TW_BITS * l)) & (TW_SLOTS - 1));
+            /* detach first: overflow timers may go straight back */
+            int i = twHead[list];
+            twHead[list] = twTail[list] = -1;
+            if (list < TW_DUE) twBusy[l][list % TW_SLOTS / 64] &= ~(1ull << (list % 64));
+            while (i >= 0) {
+                int after = timers[i].next;
+                twPush(twListFor(timers[i].when), i);
+                i = after;
+            }
+        }
+        int slot = (int)(next & (TW_SLOTS - 1));
+        while (twHead[slot] >= 0) {
+            int i = twHead[slot];
+            twUnlink(i);
+            twPush(TW_DUE, i);
+        }
+    }
+    if (wheelTime < (int64_t) to) wheelTime = to;
+    if (clockVirtual && to > clockValue) clockValue = to;
+}
+
+/* earliest pending deadline, 0 if none; O(levels + slots) */
+time_t timerNextDue() {
+    if (twHead[TW_DUE] >= 0) return (time_t) wheelTime;
+    int64_t next = twNext();
+    if (next == INT64_MAX) return 0;
+    /* a cascade point only bounds the deadlines below it: take the
+       earliest on that slot's list */
+    int64_t best = INT64_MAX;
+    for (int l = 0; l < TW_LEVELS; l++) {
+        int shift = TW_BITS * l;
+        if (next & ((1ll << shift) - 1)) break;
+        int list = l * TW_SLOTS + (int)((next >> shift) & (TW_SLOTS - 1));
+        for (int i = twHead[list]; i >= 0; i = timers[i].next) if (timers[i].when < best) best = timers[i].when;
+        if (best != INT64_MAX) break;
+    }
+    if (best == INT64_MAX)
+        for (int i = twHead[TW_OVERFLOW]; i >= 0; i = timers[i].next) if (timers[i].when < best) best = timers[i].when;
+    return best == INT64_MAX ? 0 : (time_t) best;
+}
+
+/* ----- Report snapshots (RCU) ----- */
+/* Reports read an immutable Snapshot instead of the live tables, so a
+   reporter thread never races with or blocks the gate thread. The gate
+   thread owns all mutation. After each event it calls gateCommit(), and
+   if a reader asked for a fresher view, it publishes a new snapshot. The
+   snapshot holds a copy of slotState and the queues plus the history
+   head. History nodes are append-only, and exits recorded after the
+   snapshot are hidden by comparing exitSeq. Retired snapshots are freed
+   with epoch-based reclamation once no reader can still hold them. */
+#define MAX_READERS 16
+
+typedef struct Snapshot {
+    uint64_t seq;               /* eventSeq when taken */
+    time_t taken;
+    int numSlots, freeCount;
+    SlotState *slots;           /* copy of slotState[0..numSlots] */
+    int numZones;
+    int waitCount[MAX_ZONES];
+    int *waiting;               /* zone z's queue at waiting[z * WAIT_CAP], front first */
+    Node *history;
+    uint64_t histTop;           /* histAllocated when taken */
+    int totalRevenue;
+    uint64_t retiredAt;         /* epoch when unlinked */
+    struct Snapshot *next;      /* retired / spare list */
+} Snapshot;
+
+_Atomic uint64_t eventSeq = 1;
+_Atomic(Snapshot *) currentSnap = NULL;
+_Atomic uint64_t globalEpoch = 1;
+_Atomic uint64_t readerEpoch[MAX_READERS];  /* 0: not reading */
+_Atomic int readerUsed[MAX_READERS];         /* slot claimed by a live thread */
+_Atomic int readerCount = 0;                 /* slots ever claimed: 0..readerCount-1 */
+pthread_key_t readerKey;                     /* frees the slot when its thread exits */
+pthread_once_t readerKeyOnce = PTHREAD_ONCE_INIT;
+_Atomic int snapRequested = 0;
+_Thread_local int readerSlot = -1;
+pthread_t ownerThread;
+Snapshot *retiredSnaps = NULL;  /* owner thread only */
+Snapshot *spareSnaps = NULL;    /* reclaimed, reused by the next publish */
+double lastPublish;             /* monoSeconds() of the last publish */
+
+#define SNAP_PREALLOC 3        /* enough for the owner plus a steady reader */
+
+Snapshot *snapshotAlloc() {
+    Snapshot *sn = calloc(1, sizeof(Snapshot));
+    if (!sn) return NULL;
+    sn->slots = malloc((numSlots + 1) * sizeof(SlotState));
+    sn->waiting = malloc(MAX_ZONES * WAIT_CAP * sizeof(int));
+    if (!sn->slots || !sn->waiting) { free(sn->slots); free(sn->waiting); free(sn); return NULL; }
+    sn->numSlots = numSlots;
+    return sn;
+}
+
+Snapshot *snapshotNew() {
+    Snapshot *sn = spareSnaps;
+    if (sn && sn->numSlots == numSlots) {
+        spareSnaps = sn->next;
+        return sn;
+    }
+    return snapshotAlloc();
+}
+
+void snapshotDestroy(Snapshot *sn) {
+    free(sn->slots);
+    free(sn->waiting);
+    free(sn);
+}
+
+/* moves retired snapshots no active reader can see to the spare list */
+void snapshotReclaim() {
+    uint64_t oldest = UINT64_MAX;
+    int n = atomic_load(&readerCount);
+    for (int i = 0; i < n; i++) {
+        uint64_t e = atomic_load(&readerEpoch[i]);
+        if (e && e < oldest) oldest = e;
+    }
+    Snapshot **pp = &retiredSnaps;
+    while (*pp) {
+        Snapshot *sn = *pp;
+        if (sn->retiredAt < oldest) {
+            *pp = sn->next;
+            sn->next = spareSnaps;
+            spareSnaps = sn;
+        } else {
+            pp = &sn->next;
+        }
+    }
+}
+
+/* owner thread only */
+void snapshotPublish() {
+    Snapshot *sn = snapshotNew();
+    if (!sn) return;
+    sn->seq = atomic_load(&eventSeq);
+    sn->taken = time(NULL);
+    memcpy(sn->slots, slotState, (numSlots + 1) * sizeof(SlotState));
+    sn->freeCount = freeScan(sn->slots, 1, numSlots, NULL);
+    sn->numZones = numZones;
+    for (int z = 0; z < numZones; z++) {
+        WaitQueue *w = &zones[z].wait;
+        sn->waitCount[z] = w->count;
+        for (int i = 0, idx = w->front; i < w->count; i++, idx = (idx + 1) % WAIT_CAP)
+            sn->waiting[z * WAIT_CAP + i] = w->q[idx];
+    }
+    sn->history = history;
+    sn->histTop = atomic_load_explicit(&histAllocated, memory_order_relaxed);
+    sn->totalRevenue = totalRevenue;
+    sn->next = NULL;
+    lastPublish = monoSeconds();
+    atomic_store(&snapRequested, 0);
+    Snapshot *old = atomic_exchange(&currentSnap, sn);
+    if (old) {
+        old->retiredAt = atomic_fetch_add(&globalEpoch, 1);
+        old->next = retiredSnaps;
+        retiredSnaps = old;
+    }
+    snapshotReclaim();
+}
+
+/* Called by the gate thread after every state change. A requested
+   refresh is honoured once enough events have passed to amortise the
+   copy (numSlots/16) or the published view is over 100 ms old. */
+void gateCommit() {
+    uint64_t seq = atomic_load_explicit(&eventSeq, memory_order_relaxed);
+    atomic_store_explicit(&eventSeq, seq + 1, memory_order_release);
+    if (!atomic_load_explicit(&snapRequested, memory_order_relaxed)) return;
+    Snapshot *cur = atomic_load_explicit(&currentSnap, memory_order_relaxed);
+    if (!cur || seq + 1 - cur->seq >= (uint64_t)numSlots / 16 || monoSeconds() - lastPublish > 0.1)
+        snapshotPublish();
+}
+
+void snapshotRelease() {
+    atomic_store(&readerEpoch[readerSlot], 0);
+}
+
+/* thread exit: hands the reader slot to the next thread that reads */
+static void readerExit(void *p) {
+    int slot = (int)(intptr_t)p - 1;
+    atomic_store(&readerEpoch[slot], 0);
+    atomic_store(&readerUsed[slot], 0);
+}
+
+static void readerKeyInit() {
+    pthread_key_create(&readerKey, readerExit);
+}
+
+/* claims a free reader slot for this thread; -1 if all are taken */
+static int readerClaim() {
+    pthread_once(&readerKeyOnce, readerKeyInit);
+    for (int i = 0; i < MAX_READERS; i++) {
+        int unused = 0;
+        if (!atomic_compare_exchange_strong(&readerUsed[i], &unused, 1)) continue;
+        int n = atomic_load(&readerCount);
+        while (n <= i && !atomic_compare_exchange_weak(&readerCount, &n, i + 1)) {}
+        pthread_setspecific(readerKey, (void *)(intptr_t)(i + 1));
+        return i;
+    }
+    return -1;
+}
+
+/* Pins the current snapshot until snapshotRelease (not needed if NULL,
+   which happens before the first publish, or when MAX_READERS other
+   threads are reading). The owner thread gets an up-to-date one; other
+   threads get the latest published one and ask the gate thread for a
+   refresh. */
+Snapshot *snapshotAcquire() {
+    if (readerSlot < 0 && (readerSlot = readerClaim()) < 0) {
+        fprintf(stderr, "Too many report threads (max %d).\n", MAX_READERS);
+        return NULL;
+    }
+    int owner = pthread_equal(pthread_self(), ownerThread);
+    Snapshot *cur = atomic_load(&currentSnap);
+    if (owner && (!cur || cur->seq != atomic_load(&eventSeq))) snapshotPublish();
+    atomic_store(&readerEpoch[readerSlot], atomic_load(&globalEpoch));
+    cur = atomic_load(&currentSnap);
+    if (!owner && (!cur || cur->seq != atomic_load(&eventSeq))) atomic_store(&snapRequested, 1);
+    if (!cur) snapshotRelease();
+    return cur;
+}
+
+
+/* exit time of a history node as of the snapshot, 0 if still parked then */
+time_t snapExitTime(const Snapshot *sn, const Node *n) {
+    uint64_t seq = __atomic_load_n(&n->exitSeq, __ATOMIC_ACQUIRE);
+    return seq && seq <= sn->seq ? n->exitTime : 0;
+}
+
+/* Copies history node n into out. Returns 0 at the end of the snapshot's
+   list, or once n has been recycled for a newer record (the ring
+   wrapped while the reader was walking). Seqlock-style: the gate thread
+   bumps histAllocated before it rewrites a node, and a correction to a
+   published stay runs between histRewriteBegin and histRewriteEnd, so
+   a copy taken while exitSeq was HIST_WRITING or changed is retried. */
+int snapHistRead(const Snapshot *sn, const Node *n, Node *out) {
+    if (!n) return 0;
+    uint64_t seq;
+    do {
+        seq = __atomic_load_n(&n->exitSeq, __ATOMIC_ACQUIRE);
+        memcpy(out, n, sizeof(Node));
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq == HIST_WRITING || __atomic_load_n(&n->exitSeq, __ATOMIC_RELAXED) != seq);
+    out->exitSeq = seq;
+    uint64_t top = atomic_load_explicit(&histAllocated, memory_order_relaxed);
+    return out->id <= sn->histTop && out->id + histCap > top;
+}
+
+/* waits until no reader holds a snapshot (before history nodes are reused) */
+void snapshotQuiesce() {
+    int n = atomic_load(&readerCount);
+    for (int i = 0; i < n; i++) {
+        if (i == readerSlot) continue;
+        while (atomic_load(&readerEpoch[i])) sched_yield();
+    }
+    Snapshot *old = atomic_exchange(&currentSnap, NULL);
+    if (old) {
+        old->next = retiredSnaps;
+        retiredSnaps = old;
+    }
+    while (retiredSnaps) {
+        Snapshot *sn = retiredSnaps;
+        retiredSnaps = sn->next;
+        snapshotDestroy(sn);
+    }
+    while (spareSnaps) {
+        Snapshot *sn = spareSnaps;
+        spareSnaps = sn->next;
+        snapshotDestroy(sn);
+    }
+}
+
+/* ----- Journal & export writer ----- */
+/* Output files are written through a LogWriter: LOG_BUFS buffers of
+   LOG_BUF_SIZE bytes, each written and fdatasync'ed as one unit when it
+   fills or when logFlush asks (group commit). On Linux this goes through
+   io_uring: the buffers are registered once, and a flush is a WRITE_FIXED
+   linked to an FSYNC, so the caller only blocks when every buffer is
+   still in flight. If io_uring is unavailable (old kernel, seccomp), or
+   off Linux, a flush is a plain pwrite followed by fdatasync. */
+#define LOG_BUFS 8
+#define LOG_BUF_SIZE (64 << 10)
+#define LOG_STAMPS (LOG_BUF_SIZE / 32)   /* latency samples kept per buffer */
+
+#ifdef __linux__
+typedef struct {
+    int fd;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqMap, *cqMap;
+    size_t sqMapLen, cqMapLen, sqesLen;
+} Uring;
+
+int uringInit(Uring *u, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    u->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0) return 0;
+    u->sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && u->cqMapLen > u->sqMapLen) u->sqMapLen = u->cqMapLen;
+    u->sqMap = mmap(NULL, u->sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    u->fd, IORING_OFF_SQ_RING);
+    u->cqMap = single ? u->sqMap
+                      : mmap(NULL, u->cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             u->fd, IORING_OFF_CQ_RING);
+    u->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqMap == MAP_FAILED || u->cqMap == MAP_FAILED || u->sqes == MAP_FAILED) {
+        if (u->sqMap != MAP_FAILED) munmap(u->sqMap, u->sqMapLen);
+        if (!single && u->cqMap != MAP_FAILED) munmap(u->cqMap, u->cqMapLen);
+        if (u->sqes != MAP_FAILED) munmap(u->sqes, u->sqesLen);
+        close(u->fd);
+        return 0;
+    }
+    char *sq = u->sqMap, *cq = u->cqMap;
+    u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    u->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sqArray = (unsigned *)(sq + p.sq_off.array);
+    u->cqHead = (unsigned *)(cq + p.cq_off.head);
+    u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    u->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 1;
+}
+
+void uringExit(Uring *u) {
+    munmap(u->sqes, u->sqesLen);
+    if (u->cqMap != u->sqMap) munmap(u->cqMap, u->cqMapLen);
+    munmap(u->sqMap, u->sqMapLen);
+    close(u->fd);
+}
+
+/* next free SQE; the ring is sized so there always is one */
+struct io_uring_sqe *uringSqe(Uring *u, unsigned k) {
+    unsigned idx = (*u->sqTail + k) & *u->sqMask;
+    u->sqArray[idx] = idx;
+    struct io_uring_sqe *e = &u->sqes[idx];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+/* publishes n prepared SQEs and optionally waits for one completion */
+int uringSubmit(Uring *u, unsigned n, unsigned wait) {
+    if (n) __atomic_store_n(u->sqTail, *u->sqTail + n, __ATOMIC_RELEASE);
+    int rc;
+    do rc = (int) syscall(__NR_io_uring_enter, u->fd, n, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (rc < 0 && errno == EINTR);
+    return rc;
+}
+#endif
+
+typedef struct {
+    int fd;
+    int uring;                  /* 0: pwrite fallback, 1: io_uring, 2: io_uring + registered buffers */
+    off_t offset;               /* file offset of the buffer being filled */
+    char *mem;                  /* LOG_BUFS buffers, back to back */
+    int cur, fill;              /* buffer being filled and bytes in it */
+    double window;              /* group commit: flush once the oldest byte is this old (s), 0: never */
+    double opened;              /* monoSeconds() of the first append to the current buffer */
+    int busy[LOG_BUFS];         /* write/fsync in flight */
+    int inFlight;
+    int failed;                 /* a write or fsync failed */
+    /* durability latency sampling, only if lat is set */
+    double *stamps;             /* append times, LOG_STAMPS per buffer */
+    int nStamps[LOG_BUFS];
+    double *lat;
+    long nLat, capLat;
+#ifdef __linux__
+    Uring ring;
+#endif
+} LogWriter;
+
+int useUring = 1;   /* cleared by --no-uring */
+
+const char *logBackendName(const LogWriter *w) {
+    return w->uring == 2 ? "io_uring, registered buffers" : w->uring ? "io_uring" : "pwrite + fdatasync";
+}
+
+int logSync(int fd) {
+#ifdef __linux__
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+/* buffer b is on disk: record how long each append in it waited */
+void logDurable(LogWriter *w, int b) {
+    if (!w->lat) return;
+    double now = monoSeconds();
+    for (int i = 0; i < w->nStamps[b] && w->nLat < w->capLat; i++)
+        w->lat[w->nLat++] = now - w->stamps[b * LOG_STAMPS + i];
+    w->nStamps[b] = 0;
+}
+
+#ifdef __linux__
+/* user_data: buffer index << 1 | 1 for the fsync (last link of a flush) */
+void logReap(LogWriter *w, int wait) {
+    Uring *u = &w->ring;
+    if (wait) uringSubmit(u, 0, 1);
+    unsigned head = *u->cqHead;
+    unsigned tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *c = &u->cqes[head & *u->cqMask];
+        int b = (int)(c->user_data >> 1);
+        if (c->res < 0) w->failed = 1;
+        if (c->user_data & 1) {
+            /* the fsync is cancelled if its write failed or was short */
+            w->busy[b] = 0;
+            w->inFlight--;
+            logDurable(w, b);
+        }
+    }
+    __atomic_store_n(u->cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+/* writes out the current buffer and moves on to the next free one */
+void logSubmit(LogWriter *w) {
+    int b = w->cur;
+    if (w->fill == 0) return;
+    char *buf = w->mem + (size_t)b * LOG_BUF_SIZE;
+#ifdef __linux__
+    if (w->uring) {
+        Uring *u = &w->ring;
+        struct io_uring_sqe *wr = uringSqe(u, 0);
+        wr->opcode = w->uring == 2 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        wr->fd = w->fd;
+        wr->addr = (uint64_t)(uintptr_t) buf;
+        wr->len = (unsigned) w->fill;
+        wr->off = (uint64_t) w->offset;
+        wr->buf_index = (uint16_t) b;
+        wr->flags = IOSQE_IO_LINK;
+        wr->user_data = (uint64_t) b << 1;
+        struct io_uring_sqe *fs = uringSqe(u, 1);
+        fs->opcode = IORING_OP_FSYNC;
+        fs->fd = w->fd;
+        fs->fsync_flags = IORING_FSYNC_DATASYNC;
+        fs->user_data = (uint64_t) b << 1 | 1;
+        if (uringSubmit(u, 2, 0) < 0) {
+            w->failed = 1;
+        } else {
+            w->busy[b] = 1;
+            w->inFlight++;
+        }
+    } else
+#endif
+    {
+        for (int done = 0; done < w->fill; ) {
+            ssize_t n = pwrite(w->fd, buf + done, w->fill - done, w->offset + done);
+            if (n <= 0) { w->failed = 1; break; }
+            done += (int) n;
+        }
+        if (logSync(w->fd) != 0) w->failed = 1;
+        logDurable(w, b);
+    }
+    w->offset += w->fill;
+    w->fill = 0;
+    w->cur = (b + 1) % LOG_BUFS;
+#ifdef __linux__
+    if (w->uring) {
+        logReap(w, 0);
+        while (w->busy[w->cur]) logReap(w, 1);
+    }
+#endif
+}
+
+/* trunc: start a new file instead of appending to it */
+LogWriter *logOpen(const char *path, int trunc) {
+    LogWriter *w = calloc(1, sizeof(LogWriter));
+    void *mem = NULL;
+    if (!w || posix_memalign(&mem, 4096, (size_t)LOG_BUFS * LOG_BUF_SIZE)) { free(w); return NULL; }
+    w->mem = mem;
+    w->fd = open(path, O_WRONLY | O_CREAT | (trunc ? O_TRUNC : 0), 0644);
+    if (w->fd < 0) { free(w->mem); free(w); return NULL; }
+    w->offset = lseek(w->fd, 0, SEEK_END);
+#ifdef __linux__
+    if (useUring && uringInit(&w->ring, 2 * LOG_BUFS)) {
+        w->uring = 1;
+        struct iovec iov[LOG_BUFS];
+        for (int b = 0; b < LOG_BUFS; b++) {
+            iov[b].iov_base = w->mem + (size_t)b * LOG_BUF_SIZE;
+            iov[b].iov_len = LOG_BUF_SIZE;
+        }
+        /* pinning can fail under a low RLIMIT_MEMLOCK: plain writes then */
+        if (syscall(__NR_io_uring_register, w->ring.fd, IORING_REGISTER_BUFFERS, iov, LOG_BUFS) == 0)
+            w->uring = 2;
+    }
+#endif
+    return w;
+}
+
+void logAppend(LogWriter *w, const void *data, int len) {
+    const char *p = data;
+    if (w->window > 0 && w->fill == 0) w->opened = monoSeconds();
+    while (len > 0) {
+        int n = LOG_BUF_SIZE - w->fill;
+        if (n > len) n = len;
+        memcpy(w->mem + (size_t)w->cur * LOG_BUF_SIZE + w->fill, p, n);
+        if (w->lat && w->nStamps[w->cur] < LOG_STAMPS)
+            w->stamps[w->cur * LOG_STAMPS + w->nStamps[w->cur]++] = monoSeconds();
+        w->fill += n;
+        p += n;
+        len -= n;
+        if (w->fill == LOG_BUF_SIZE) {
+            logSubmit(w);
+            if (w->window > 0) w->opened = monoSeconds();
+        }
+    }
+    if (w->window > 0 && w->fill && monoSeconds() - w->opened >= w->window) logSubmit(w);
+}
+
+/* submits what is buffered; with wait, returns once it is all on disk */
+int logFlush(LogWriter *w, int wait) {
+    logSubmit(w);
+#ifdef __linux__
+    if (w->uring) {
+        logReap(w, 0);
+        while (wait && w->inFlight) logReap(w, 1);
+    }
+#endif
+    return !w->failed;
+}
+
+int logClose(LogWriter *w) {
+    int ok = logFlush(w, 1);
+#ifdef __linux__
+    if (w->uring) uringExit(&w->ring);
+#endif
+    if (close(w->fd) != 0) ok = 0;
+    free(w->mem);
+    free(w->stamps);
+    free(w->lat);
+    free(w);
+    return ok;
+}
+
+/* Journal (--journal FILE): one fixed-size record per gate event,
+   committed in groups at most JOURNAL_WINDOW apart and at the end of
+   every menu command. */
+#define JOURNAL_WINDOW 0.001
+enum { JR_ENTRY = 1, JR_QUEUED, JR_EXIT, JR_UNQUEUED, JR_EMERGENCY, JR_PASS, JR_POLICY, JR_OFFER, JR_EXPIRED, JR_AMEND };
+
+typedef struct {
+    uint32_t type;      /* JR_* */
+    int32_t car;
+    int32_t slot;
+    int32_t fee;
+    int64_t time;
+    uint64_t seq;       /* eventSeq of the event */
+} JournalRec;
+
+LogWriter *journal = NULL;
+
+void journalEvent(int type, int car, int slot, int fee, time_t t) {
+    if (!journal) return;
+    JournalRec rec = { (uint32_t) type, car, slot, fee, (int64_t) t,
+                       atomic_load_explicit(&eventSeq, memory_order_relaxed) };
+    logAppend(journal, &rec, sizeof(rec));
+}
+
+/* ----- Latency profile (-DGATE_PROFILE) ----- */
+/* Building with -DGATE_PROFILE times the phases of each gate event with
+   the cycle counter (rdtsc, cntvct, else the monotonic clock). Every
+   thread records into its own log-linear (HDR-style) histogram with 64
+   sub-buckets per power of two, so reported values are within 1.6%.
+   Only every Nth event is timed (--profile-every N, default 64): in a VM
+   a counter read can cost as much as a whole gate phase. Without the
+   flag the PROF_* macros compile to nothing. */
+enum { PH_VALIDATE, PH_ALLOC, PH_HISTORY, PH_FEE, PH_OUTPUT, PH_COUNT };
+
+const char *phaseName[PH_COUNT] = { "validate", "allocate", "history", "fee", "output" };
+int profEvery = 64;     /* --profile-every */
+
+#ifdef GATE_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define HDR_SUB 64
+#define HDR_MAX_BITS 40                          /* larger values are clamped */
+#define HDR_LEN ((HDR_MAX_BITS - 5) * HDR_SUB)
+
+typedef struct ProfHist {
+    uint64_t counts[PH_COUNT][HDR_LEN];
+    uint64_t max[PH_COUNT];
+    struct ProfHist *next;
+} ProfHist;
+
+ProfHist *profAll = NULL;       /* every thread's histogram, under profLock */
+pthread_mutex_t profLock = PTHREAD_MUTEX_INITIALIZER;
+_Thread_local ProfHist *profMine = NULL;
+_Thread_local int profOn = 0;
+_Thread_local int profCountdown = 0;
+double profNsPerTick = 1.0;
+
+static inline uint64_t profTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void profCalibrate() {
+    double t0 = monoSeconds();
+    uint64_t c0 = profTicks();
+    while (monoSeconds() - t0 < 0.02) {}
+    uint64_t c1 = profTicks();
+    profNsPerTick = (monoSeconds() - t0) * 1e9 / (double)(c1 - c0 ? c1 - c0 : 1);
+}
+
+static inline int hdrIndex(uint64_t v) {
+    if (v >> HDR_MAX_BITS) v = (1ull << HDR_MAX_BITS) - 1;
+    int b = 63 - __builtin_clzll(v | (2 * HDR_SUB - 1)) - 6;
+    return b * HDR_SUB + (int)(v >> b);
+}
+
+uint64_t hdrValue(int idx) {
+    int b = idx < 2 * HDR_SUB ? 0 : idx / HDR_SUB - 1;
+    return (uint64_t)(idx - b * HDR_SUB) << b;
+}
+
+/* decides whether this thread's current event is timed */
+static inline void profEvent(void) {
+    profOn = --profCountdown <= 0;
+    if (profOn) profCountdown = profEvery;
+}
+
+void profRecord(int ph, uint64_t ticks) {
+    ProfHist *h = profMine;
+    if (!h) {
+        h = profMine = calloc(1, sizeof(ProfHist));
+        if (!h) { profOn = 0; return; }
+        pthread_mutex_lock(&profLock);
+        h->next = profAll;
+        profAll = h;
+        pthread_mutex_unlock(&profLock);
+    }
+    h->counts[ph][hdrIndex(ticks)]++;
+    if (ticks > h->max[ph]) h->max[ph] = ticks;
+}
+
+#define PROF_EVENT() profEvent()
+#define PROF_BEGIN(t) uint64_t t = profOn ? profTicks() : 0
+#define PROF_END(t, ph) do { if (profOn) profRecord(ph, profTicks() - (t)); } while (0)
+
+/* merges all threads' histograms (counters are read racily, which is fine
+   for a report) and prints percentiles in ns */
+void profDump() {
+    static uint64_t merged[HDR_LEN];
+    printf("\nLatency profile (ns), 1 in %d events timed\n", profEvery);
+    printf("  %-9s %10s %8s %8s %8s %8s %8s\n", "phase", "count", "p50", "p90", "p99", "p99.9", "max");
+    pthread_mutex_lock(&profLock);
+    for (int ph = 0; ph < PH_COUNT; ph++) {
+        uint64_t total = 0, maxT = 0;
+        memset(merged, 0, sizeof(merged));
+        for (ProfHist *h = profAll; h; h = h->next) {
+            for (int i = 0; i < HDR_LEN; i++) merged[i] += h->counts[ph][i];
+            if (h->max[ph] > maxT) maxT = h->max[ph];
+        }
+        for (int i = 0; i < HDR_LEN; i++) total += merged[i];
+        if (!total) continue;
+        const double q[4] = { 0.5, 0.9, 0.99, 0.999 };
+        double at[4];
+        uint64_t seen = 0;
+        int k = 0;
+        for (int i = 0; i < HDR_LEN && k < 4; i++) {
+            seen += merged[i];
+            while (k < 4 && seen >= (uint64_t)(q[k] * total + 0.5)) at[k++] = hdrValue(i) * profNsPerTick;
+        }
+        while (k < 4) at[k++] = maxT * profNsPerTick;
+        printf("  %-9s %10llu %8.0f %8.0f %8.0f %8.0f %8.0f\n", phaseName[ph], (unsigned long long) total,
+               at[0], at[1], at[2], at[3], maxT * profNsPerTick);
+    }
+    pthread_mutex_unlock(&profLock);
+}
+#else
+#define PROF_EVENT() ((void)0)
+#define PROF_BEGIN(t) ((void)0)
+#define PROF_END(t, ph) ((void)0)
+
+void profCalibrate() {}
+
+void profDump() {
+    printf("Latency profile not built in (compile with -DGATE_PROFILE).\n");
+}
+#endif
+
+/* ----- Dwell analytics ----- */
+/* One log-linear histogram of stay length per (zone, arrival hour, pass
+   status), updated on every exit. Buckets are exact up to 63 s and then
+   32 per power of two, so quantiles are within 1.6% of the true stay;
+   stays past 2^24 s (194 days) are clamped. A sketch is a fixed 2.5 KB
+   of counters, so sketches merge by adding them: any slice (one hour,
+   one zone, all pass holders) is a merge, and so is another lot's dump
+   loaded with "dwell-load". Zones stand in for slot classes. */
+#define DWELL_SUB 32
+#define DWELL_MAX_BITS 24
+#define DWELL_LEN ((DWELL_MAX_BITS - 4) * DWELL_SUB)
+#define DWELL_HOURS 24
+#define DWELL_MAGIC 0x4c455744u     /* "DWEL" */
+
+typedef struct {
+    uint32_t counts[DWELL_LEN];
+    uint64_t total;
+    uint64_t max;
+} DwellSketch;
+
+DwellSketch *dwellCells;        /* [zone][hour][pass] */
+long dwellTzOff;                /* local time minus UTC, fixed at start */
+
+static inline int dwellIndex(uint64_t v) {
+    if (v >> DWELL_MAX_BITS) v = (1ull << DWELL_MAX_BITS) - 1;
+    int b = 63 - __builtin_clzll(v | (2 * DWELL_SUB - 1)) - 5;
+    return b * DWELL_SUB + (int)(v >> b);
+}
+
+/* middle of the bucket */
+double dwellValue(int idx) {
+    int b = idx < 2 * DWELL_SUB ? 0 : idx / DWELL_SUB - 1;
+    return (double)((uint64_t)(idx - b * DWELL_SUB) << b) + ((1ull << b) - 1) / 2.0;
+}
+
+static inline DwellSketch *dwellCell(int zone, int hour, int pass) {
+    return &dwellCells[(zone * DWELL_HOURS + hour) * 2 + pass];
+}
+
+int dwellAlloc() {
+    dwellCells = calloc((size_t) numZones * DWELL_HOURS * 2, sizeof(DwellSketch));
+    time_t t = time(NULL);
+    struct tm tmst;
+    localtime_r(&t, &tmst);
+    dwellTzOff = tmst.tm_gmtoff;
+    return dwellCells != NULL;
+}
+
+void dwellReset() {
+    memset(dwellCells, 0, (size_t) numZones * DWELL_HOURS * 2 * sizeof(DwellSketch));
+}
+
+static inline void dwellRecord(int slot, int pass, time_t entry, long secs) {
+    long h = ((long)((entry + dwellTzOff) % 86400) + 86400) % 86400 / 3600;
+    DwellSketch *d = dwellCell((slot - 1) / zoneSpan, (int) h, pass != 0);
+    uint64_t v = secs > 0 ? (uint64_t) secs : 0;
+    d->counts[dwellIndex(v)]++;
+    d->total++;
+    if (v > d->max) d->max = v;
+}
+
+void dwellMerge(DwellSketch *dst, const DwellSketch *src) {
+    for (int i = 0; i < DWELL_LEN; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/* merges every cell matching zone / hour / pass (-1 = any) into out */
+void dwellSlice(DwellSketch *out, int zone, int hour, int pass) {
+    memset(out, 0, sizeof(*out));
+    for (int z = 0; z < numZones; z++) {
+        if (zone >= 0 && z != zone) continue;
+        for (int h = 0; h < DWELL_HOURS; h++) {
+            if (hour >= 0 && h != hour) continue;
+            for (int p = 0; p < 2; p++)
+                if ((pass < 0 || p == pass) && dwellCell(z, h, p)->total) dwellMerge(out, dwellCell(z, h, p));
+        }
+    }
+}
+
+/* fills at[i] with the q[i] quantile in seconds; q must be ascending */
+void dwellQuantiles(const DwellSketch *d, const double *q, int n, double *at) {
+    uint64_t seen = 0;
+    int k = 0;
+    for (int i = 0; i < DWELL_LEN && k < n; i++) {
+        seen += d->counts[i];
+        while (k < n && seen >= (uint64_t)(q[k] * d->total + 0.5) && seen) {
+            double v = dwellValue(i);
+            at[k++] = v < (double) d->max ? v : (double) d->max;
+        }
+    }
+    while (k < n) at[k++] = (double) d->max;
+}
+
+void dwellRow(const char *label, int zone, int hour, int pass) {
+    static DwellSketch s;
+    static const double q[3] = { 0.5, 0.9, 0.99 };
+    double at[3];
+    dwellSlice(&s, zone, hour, pass);
+    if (!s.total) return;
+    dwellQuantiles(&s, q, 3, at);
+    printf("  %-12s %9llu %8.1f %8.1f %8.1f %8.1f\n", label, (unsigned long long) s.total,
+           at[0] / 60, at[1] / 60, at[2] / 60, s.max / 60.0);
+}
+
+void dwellReport() {
+    static DwellSketch all;
+    char label[32];
+    double t0 = monoSeconds();
+    dwellSlice(&all, -1, -1, -1);
+    double queryUs = (monoSeconds() - t0) * 1e6;
+    printf("\nDwell time (minutes), %llu stays, whole-lot query %.1f us\n", (unsigned long long) all.total, queryUs);
+    if (!all.total) return;
+    printf("  %-12s %9s %8s %8s %8s %8s\n", "arrival", "stays", "p50", "p90", "p99", "max");
+    for (int h = 0; h < DWELL_HOURS; h++) {
+        snprintf(label, sizeof(label), "%02d:00-%02d:00", h, (h + 1) % 24);
+        dwellRow(label, -1, h, -1);
+    }
+    printf("  %-12s\n", "zone");
+    for (int z = 0; z < numZones; z++) {
+        snprintf(label, sizeof(label), "%d (%d-%d)", z, zones[z].first, zones[z].last);
+        dwellRow(label, z, -1, -1);
+    }
+    printf("  %-12s\n", "customer");
+    dwellRow("regular", -1, -1, 0);
+    dwellRow("monthly pass", -1, -1, 1);
+    dwellRow("all", -1, -1, -1);
+}
+
+/* raw sketches, so another lot (or a later run) can merge them */
+int dwellSave(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    uint32_t hdr[4] = { DWELL_MAGIC, DWELL_SUB, DWELL_LEN, (uint32_t) numZones };
+    int ok = fwrite(hdr, sizeof(hdr), 1, f) == 1 &&
+             fwrite(dwellCells, sizeof(DwellSketch), (size_t) numZones * DWELL_HOURS * 2, f) == (size_t) numZones * DWELL_HOURS * 2;
+    return fclose(f) == 0 && ok;
+}
+
+/* adds a saved dump into the live sketches, zone by zone; zones this lot
+   does not have are folded into its last one */
+int dwellLoad(const char *path) {
+    static DwellSketch s;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    uint32_t hdr[4];
+    int ok = fread(hdr, sizeof(hdr), 1, f) == 1 && hdr[0] == DWELL_MAGIC && hdr[1] == DWELL_SUB &&
+             hdr[2] == DWELL_LEN && hdr[3] >= 1 && hdr[3] <= MAX_ZONES;
+    for (uint32_t c = 0; ok && c < hdr[3] * DWELL_HOURS * 2; c++) {
+        ok = fread(&s, sizeof(s), 1, f) == 1;
+        int z = (int)(c / (DWELL_HOURS * 2));
+        if (ok) dwellMerge(dwellCell(z < numZones ? z : numZones - 1, c / 2 % DWELL_HOURS, c % 2), &s);
+    }
+    fclose(f);
+    return ok;
+}
+
+/* ----- Occupancy time series ----- */
+/* Occupied-slot count as a step function, rolled up on every change into
+   four rings of buckets: 1 s for an hour, 1 min for 30 days, 1 h for 400
+   days and 1 day for 10 years (about 2 MB whatever the uptime). A bucket
+   keeps min, max and occupancy-seconds, so averages are time-weighted.
+   Only buckets that saw a change are written; one that did not held the
+   value the next written bucket was entered with, and a query treats time
+   after the last change as holding its value. Buckets are aligned to
+   UTC. */
+typedef struct {
+    int64_t key;        /* bucket number + 1, 0 if never used */
+    int32_t min, max;
+    int32_t enter;      /* value held up to the start of the bucket */
+    int32_t secs;       /* seconds of the bucket recorded */
+    int64_t area;       /* occupancy-seconds recorded */
+} OccBucket;
+
+typedef struct {
+    const char *name;
+    int width;          /* seconds per bucket */
+    int len;
+    OccBucket *b;
+    int64_t cur;        /* bucket holding occLast */
+    int pos;            /* where cur goes in the ring once closed */
+    OccBucket open;     /* bucket cur, kept here until it closes */
+} OccLevel;
+
+#define OCC_LEVELS 4
+#define OCC_SCAN_MAX 4096   /* buckets per range query before going coarser */
+
+OccLevel occLevels[OCC_LEVELS] = {
+    { "second", 1, 3600, NULL, 0, 0, { 0, 0, 0, 0, 0, 0 } },
+    { "minute", 60, 30 * 1440, NULL, 0, 0, { 0, 0, 0, 0, 0, 0 } },
+    { "hour", 3600, 400 * 24, NULL, 0, 0, { 0, 0, 0, 0, 0, 0 } },
+    { "day", 86400, 3660, NULL, 0, 0, { 0, 0, 0, 0, 0, 0 } },
+};
+int occStarted = 0;
+time_t occStart;        /* time of the first record */
+time_t occLast;         /* time of the last change */
+int occValue;           /* occupancy since occLast */
+
+typedef struct {
+    int min, max;
+    double area;
+    long secs;
+    int buckets;
+} OccAgg;
+
+int occAlloc() {
+    for (int l = 0; l < OCC_LEVELS; l++) {
+        occLevels[l].b = calloc(occLevels[l].len, sizeof(OccBucket));
+        if (!occLevels[l].b) return 0;
+    }
+    return 1;
+}
+
+void occFree() {
+    for (int l = 0; l < OCC_LEVELS; l++) {
+        free(occLevels[l].b);
+        occLevels[l].b = NULL;
+    }
+}
+
+void occReset() {
+    for (int l = 0; l < OCC_LEVELS; l++) memset(occLevels[l].b, 0, occLevels[l].len * sizeof(OccBucket));
+    occStarted = 0;
+}
+
+int occupancyNow() {
+    int avail = 0;
+    for (int z = 0; z < numZones; z++) avail += zoneFreeCount(&zones[z]);
+    return numSlots - avail;
+}
+
+/* adds the current value over [since, until) to level L, closing its
+   open bucket into the ring if until is past it. A new open bucket that
+   has not been held at any value yet has min > max. */
+static inline void occAdvance(OccLevel *L, time_t since, time_t until) {
+    int64_t w = L->width;
+    time_t curEnd = (L->cur + 1) * w;
+    OccBucket *c = &L->open;
+    if (until < curEnd) {
+        c->area += (int64_t) occValue * (until - since);
+        c->secs += (int32_t)(until - since);
+        return;
+    }
+    c->area += (int64_t) occValue * (curEnd - since);
+    c->secs += (int32_t)(curEnd - since);
+    L->b[L->pos] = *c;
+    int64_t end = until < curEnd + w ? L->cur + 1 : until / w;
+    L->pos = end - L->cur < L->len && L->pos + (end - L->cur) < L->len ? L->pos + (int)(end - L->cur)
+           : (int)(end % L->len);
+    L->cur = end;
+    int32_t held = (int32_t)(until - end * w);
+    *c = held ? (OccBucket){ end + 1, occValue, occValue, occValue, held, (int64_t) occValue * held }
+              : (OccBucket){ end + 1, INT_MAX, INT_MIN, occValue, 0, 0 };
+}
+
+/* the occupancy becomes v at time t. Changes only touch the finest open
+   bucket until it closes; then it is folded into the coarser open
+   buckets, which move on to where the new finest bucket starts. A ring
+   is only written when its open bucket closes. */
+void occUpdate(time_t t, int v) {
+    if (!occStarted) {
+        for (int l = 0; l < OCC_LEVELS; l++) {
+            OccLevel *L = &occLevels[l];
+            L->cur = t / L->width;
+            L->pos = (int)(L->cur % L->len);
+            L->open = (OccBucket){ L->cur + 1, v, v, v, 0, 0 };
+        }
+        occStart = occLast = t;
+        occValue = v;
+        occStarted = 1;
+        return;
+    }
+    if (t < occLast) t = occLast;
+    OccLevel *F = &occLevels[0];
+    OccBucket *f = &F->open;
+    time_t fEnd = (F->cur + 1) * F->width;
+    if (t < fEnd) {
+        f->area += (int64_t) occValue * (t - occLast);
+        f->secs += (int32_t)(t - occLast);
+    } else {
+        f->area += (int64_t) occValue * (fEnd - occLast);
+        f->secs += (int32_t)(fEnd - occLast);
+        for (int l = 1; l < OCC_LEVELS; l++) {
+            OccBucket *c = &occLevels[l].open;
+            if (f->min < c->min) c->min = f->min;
+            if (f->max > c->max) c->max = f->max;
+            c->area += f->area;
+            c->secs += f->secs;
+        }
+        occAdvance(F, fEnd, t);
+        time_t start = F->cur * F->width;
+        for (int l = 1; l < OCC_LEVELS; l++) occAdvance(&occLevels[l], fEnd, start);
+    }
+    if (v < f->min) f->min = v;
+    if (v > f->max) f->max = v;
+    occLast = t;
+    occValue = v;
+}
+
+/* after every event that can change occupancy */
+static inline void occRecord(time_t now) {
+    int v = occupancyNow();
+    if (!occStarted || v != occValue) occUpdate(now, v);
+}
+
+/* folds buckets [k0, k1) of L, as seen at time now, into a */
+void occScan(const OccLevel *L, int64_t k0, int64_t k1, time_t now, OccAgg *a) {
+    int64_t w = L->width, runEnd = -1;
+    int runValue = 0;
+    if (!occStarted) return;
+    if (k0 <= L->cur - L->len) k0 = L->cur - L->len + 1;
+    for (int64_t k = k0; k < k1; k++) {
+        int mn, mx;
+        double area;
+        long secs;
+        if ((k + 1) * w <= occStart) continue;
+        if (k > L->cur) {
+            time_t to = (k + 1) * w < now ? (k + 1) * w : now;
+            secs = to - k * w;
+            if (secs <= 0) break;
+            mn = mx = occValue;
+            area = (double) occValue * secs;
+        } else if (k == L->cur) {
+            /* plus the finest open bucket, not yet folded in */
+            const OccBucket *c = &L->open, *f = &occLevels[0].open;
+            mn = c->min;
+            mx = c->max;
+            area = (double) c->area;
+            secs = c->secs;
+            if (L != &occLevels[0]) {
+                if (f->min < mn) mn = f->min;
+                if (f->max > mx) mx = f->max;
+                area += (double) f->area;
+                secs += f->secs;
+            }
+            time_t to = (k + 1) * w < now ? (k + 1) * w : now;
+            if (to > occLast) {
+                area += (double) occValue * (to - occLast);
+                secs += to - occLast;
+            }
+        } else if (L->b[k % L->len].key == k + 1) {
+            const OccBucket *c = &L->b[k % L->len];
+            mn = c->min;
+            mx = c->max;
+            area = (double) c->area;
+            secs = c->secs;
+        } else {
+            /* no change in k: find the next bucket that has one */
+            if (k >= runEnd) {
+                for (runEnd = k + 1; runEnd < L->cur && L->b[runEnd % L->len].key != runEnd + 1; runEnd++) {}
+                runValue = runEnd < L->cur ? L->b[runEnd % L->len].enter : L->open.enter;
+            }
+            mn = mx = runValue;
+            secs = w;
+            area = (double) runValue * w;
+        }
+        if (!a->buckets || mn < a->min) a->min = mn;
+        if (!a->buckets || mx > a->max) a->max = mx;
+        a->area += area;
+        a->secs += secs;
+        a->buckets++;
+    }
+}
+
+/* the finest level that still holds from and needs at most OCC_SCAN_MAX
+   buckets, else the coarsest one that holds it */
+const OccLevel *occPick(time_t from, time_t to) {
+    const OccLevel *best = &occLevels[OCC_LEVELS - 1];
+    for (int l = OCC_LEVELS - 1; l >= 0; l--) {
+        const OccLevel *L = &occLevels[l];
+        int held = from / L->width > L->cur - L->len;
+        if (!held) break;
+        best = L;
+        if ((to - from) / L->width <= OCC_SCAN_MAX) continue;
+        best = l < OCC_LEVELS - 1 ? &occLevels[l + 1] : L;
+        break;
+    }
+    return best;
+}
+
+/* min / max / time-weighted average over [from, to), rounded out to the
+   buckets of the level used; 0 if there is no data */
+int occRange(time_t from, time_t to, time_t now, OccAgg *a, const OccLevel **used) {
+    const OccLevel *L = occPick(from, to);
+    memset(a, 0, sizeof(*a));
+    if (used) *used = L;
+    occScan(L, from / L->width, (to + L->width - 1) / L->width, now, a);
+    return a->buckets > 0;
+}
+
+double occAvg(const OccAgg *a) {
+    return a->secs ? a->area / a->secs : a->min;
+}
+
+void occupancyReport() {
+    static const struct { const char *label; long secs; } spans[] = {
+        { "last hour", 3600 }, { "last day", 86400 }, { "last 7 days", 7 * 86400 },
+        { "last 30 days", 30 * 86400 }, { "last year", 365 * 86400L },
+    };
+    time_t now = clockNow();
+    printf("\nOccupancy (of %d slots), now %d\n", numSlots, occupancyNow());
+    printf("  %-13s %6s %6s %8s  %-8s %8s\n", "span", "min", "max", "avg", "from", "query us");
+    for (size_t i = 0; i < sizeof(spans) / sizeof(spans[0]); i++) {
+        OccAgg a;
+        const OccLevel *L;
+        double t0 = monoSeconds();
+        int ok = occRange(now - spans[i].secs, now, now, &a, &L);
+        double us = (monoSeconds() - t0) * 1e6;
+        if (!ok) continue;
+        printf("  %-13s %6d %6d %8.2f  %-8s %8.1f\n", spans[i].label, a.min, a.max, occAvg(&a), L->name, us);
+    }
+}
+
+/* CSV of [now - secs, now) in steps of step seconds, for planning; rows
+   without data are left empty */
+int occupancyExport(const char *path, long step, long secs) {
+    if (step < 1 || secs < step) return 0;
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    time_t now = clockNow(), start = (now - secs) / step * step;
+    /* the coarsest level whose buckets tile the step */
+    const OccLevel *L = &occLevels[0];
+    for (int l = 1; l < OCC_LEVELS; l++) if (step % occLevels[l].width == 0) L = &occLevels[l];
+    fprintf(f, "start,min,max,avg\n");
+    for (time_t t = start; t < now; t += step) {
+        OccAgg a = { 0, 0, 0, 0, 0 };
+        occScan(L, t / L->width, (t + step) / L->width, now, &a);
+        char buf[32];
+        format_time(t, buf, sizeof(buf));
+        if (a.buckets) fprintf(f, "%s,%d,%d,%.3f\n", buf, a.min, a.max, occAvg(&a));
+        else fprintf(f, "%s,,,\n", buf);
+    }
+    return fclose(f) == 0;
+}
+
+/* ----- Slot utilization ----- */
+/* Reads the per-slot counters kept by the gate; an open stay counts up
+   to now. Ranking keeps the top few in small sorted arrays, so the
+   report is one pass over the slots. */
+
+#define USE_RANK 5
+#define USE_CELLS 1024
+#define USE_ROW 64
+
+static double slotBusyNow(int s, time_t now) {
+    double b = (double) slotUse[s].busySecs;
+    if (slotState[s].car != SLOT_FREE && !slotHeld(s) && now > slotEntryTime(s)) b += (double)(now - slotEntryTime(s));
+    return b;
+}
+
+/* keeps rank[0..*n) ordered by busy, highest first when hi, else lowest */
+static void useRankAdd(int *rank, int *n, int s, const double *busy, int hi) {
+    int i = *n < USE_RANK ? (*n)++ : USE_RANK;
+    while (i > 0 && (hi ? busy[s] > busy[rank[i - 1]] : busy[s] < busy[rank[i - 1]])) {
+        if (i < USE_RANK) rank[i] = rank[i - 1];
+        i--;
+    }
+    if (i < USE_RANK) rank[i] = s;
+}
+
+static void useRankPrint(const char *title, const int *rank, int n, const double *busy, double span) {
+    printf("  %s\n", title);
+    for (int i = 0; i < n; i++) {
+        int s = rank[i];
+        const SlotUse *u = &slotUse[s];
+        printf("    slot %-7d zone %-2d %6.1f%% busy %7u stays  avg %6.1f min\n", s, (s - 1) / zoneSpan,
+               100.0 * busy[s] / span, u->sessions, u->sessions ? (double) u->busySecs / u->sessions / 60 : 0.0);
+    }
+}
+
+void slotUseReport() {
+    time_t now = clockNow();
+    double span = now > useSince ? (double)(now - useSince) : 1;
+    double *busy = malloc((numSlots + 1) * sizeof(double));
+    if (!busy) { printf("Out of memory.\n"); return; }
+    int top[USE_RANK], low[USE_RANK], nt = 0, nl = 0;
+    long unused = 0;
+    double total = 0;
+    for (int s = 1; s <= numSlots; s++) {
+        busy[s] = slotBusyNow(s, now);
+        total += busy[s];
+        if (busy[s] == 0 && slotUse[s].sessions == 0) unused++;
+        useRankAdd(top, &nt, s, busy, 1);
+        useRankAdd(low, &nl, s, busy, 0);
+    }
+    char since[32];
+    format_time(useSince, since, sizeof(since));
+    printf("\nSlot utilization since %s: mean %.1f%% busy, %ld slots never used\n",
+           since, 100.0 * total / span / numSlots, unused);
+    useRankPrint("busiest:", top, nt, busy, span);
+    useRankPrint("idlest:", low, nl, busy, span);
+
+    /* heatmap: one cell per slot, or per run of slots when there are more
+       slots than cells, shaded by the run's busy fraction */
+    static const char shades[] = " .:-=+*#%@";
+    int per = (numSlots + USE_CELLS - 1) / USE_CELLS;
+    int cells = (numSlots + per - 1) / per;
+    printf("  heatmap, %d slot%s per cell, ' ' idle .. '@' always busy\n", per, per == 1 ? "" : "s");
+    for (int c = 0; c < cells; c++) {
+        int first = c * per + 1, last = first + per - 1 < numSlots ? first + per - 1 : numSlots;
+        double b = 0;
+        for (int s = first; s <= last; s++) b += busy[s];
+        double f = b / span / (last - first + 1);
+        int k = f <= 0 ? 0 : 1 + (int)(f * (sizeof(shades) - 3));
+        if (k > (int) sizeof(shades) - 2) k = sizeof(shades) - 2;
+        if (c % USE_ROW == 0) printf("  %7d |", first);
+        putchar(shades[k]);
+        if (c % USE_ROW == USE_ROW - 1 || c == cells - 1) printf("|\n");
+    }
+    free(busy);
+}
+
+/* ----- End-of-day report (parallel history scan) ----- */
+/* Revenue and stays per day, arrivals per hour and per-slot totals over
+   the history ring as of one snapshot. histScan cuts the ring's segments
+   into chunks of HIST_CHUNK nodes which --report-threads workers claim
+   from a shared counter; each folds its chunks into a private part and
+   the caller sums the parts, so workers share nothing but the counter
+   and the nodes they read. A stay counts on the day it ended. */
+#define HIST_CHUNK 16384
+#define HIST_MAX_THREADS 64
+#define EOD_MAX_DAYS 366
+
+/* folds nodes[0..len) (live ring nodes, read through snapHistRead) into part */
+typedef void (*HistFold)(const Snapshot *sn, Node *nodes, int len, void *part, const void *arg);
+
+typedef struct {
+    const Snapshot *sn;
+    Node **chunk;               /* first node of each chunk */
+    int *chunkLen;
+    int chunks;
+    _Atomic int next;
+    HistFold fold;
+    const void *arg;
+} HistJob;
+
+typedef struct {
+    HistJob *job;
+    void *part;
+} HistWorker;
+
+int reportThreads = 0;          /* --report-threads, 0: one per online CPU */
+
+static void *histWorkerMain(void *p) {
+    HistWorker *w = p;
+    HistJob *job = w->job;
+    for (int c; (c = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed)) < job->chunks;)
+        job->fold(job->sn, job->chunk[c], job->chunkLen[c], w->part, job->arg);
+    return NULL;
+}
+
+/* Runs fold over the whole ring as of sn on threads workers, worker t
+   folding into parts[t]; the caller is worker 0. 0 if out of memory. */
+int histScan(const Snapshot *sn, int threads, HistFold fold, const void *arg, void **parts) {
+    HistJob job = { .sn = sn, .fold = fold, .arg = arg };
+    for (HistSeg *seg = histSegs; seg; seg = seg->next) job.chunks += (seg->used + HIST_CHUNK - 1) / HIST_CHUNK;
+    job.chunk = malloc((job.chunks + 1) * sizeof(Node *));
+    job.chunkLen = malloc((job.chunks + 1) * sizeof(int));
+    if (!job.chunk || !job.chunkLen) { free(job.chunk); free(job.chunkLen); return 0; }
+    int c = 0;
+    for (HistSeg *seg = histSegs; seg && c < job.chunks; seg = seg->next)
+        for (int off = 0; off < seg->used && c < job.chunks; off += HIST_CHUNK, c++) {
+            job.chunk[c] = &seg->nodes[off];
+            job.chunkLen[c] = seg->used - off < HIST_CHUNK ? seg->used - off : HIST_CHUNK;
+        }
+    job.chunks = c;
+    atomic_init(&job.next, 0);
+    pthread_t tid[HIST_MAX_THREADS];
+    HistWorker w[HIST_MAX_THREADS];
+    int started[HIST_MAX_THREADS] = { 0 };
+    for (int t = 0; t < threads; t++) w[t] = (HistWorker){ &job, parts[t] };
+    for (int t = 1; t < threads; t++) started[t] = pthread_create(&tid[t], NULL, histWorkerMain, &w[t]) == 0;
+    /* a worker that failed to start claims nothing: its part stays empty */
+    histWorkerMain(&w[0]);
+    for (int t = 1; t < threads; t++) if (started[t]) pthread_join(tid[t], NULL);
+    free(job.chunk);
+    free(job.chunkLen);
+    return 1;
+}
+
+int histThreads() {
+    long n = reportThreads > 0 ? reportThreads : sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > HIST_MAX_THREADS ? HIST_MAX_THREADS : (int) n;
+}
+
+typedef struct {
+    uint64_t busySecs;
+    uint32_t sessions;
+    int32_t revenue;
+} EodSlot;
+
+typedef struct {
+    uint64_t sessions[EOD_MAX_DAYS];
+    uint64_t staySecs[EOD_MAX_DAYS];
+    int64_t revenue[EOD_MAX_DAYS];
+    uint64_t arrivals[24];
+    uint64_t scanned, open, earlier;
+    int64_t earlierRevenue;
+    EodSlot *slot;              /* numSlots + 1 */
+} EodPart;
+
+typedef struct {
+    time_t day0;                /* local midnight starting the first day */
+    int days;
+} EodSpan;
+
+static void eodFold(const Snapshot *sn, Node *nodes, int len, void *part, const void *arg) {
+    const EodSpan *span = arg;
+    EodPart *p = part;
+    for (int i = 0; i < len; i++) {
+        Node n;
+        if (!snapHistRead(sn, &nodes[i], &n)) continue;
+        p->scanned++;
+        time_t exit = n.exitSeq && n.exitSeq <= sn->seq ? n.exitTime : 0;
+        if (!exit) { p->open++; continue; }
+        if (exit < span->day0) { p->earlier++; p->earlierRevenue += n.fee; continue; }
+        long d = (long)((exit - span->day0) / 86400);
+        if (d >= span->days) d = span->days - 1;
+        long stay = exit > n.entryTime ? (long)(exit - n.entryTime) : 0;
+        p->sessions[d]++;
+        p->staySecs[d] += (uint64_t) stay;
+        p->revenue[d] += n.fee;
+        long h = (long)((n.entryTime - span->day0) % 86400);
+        p->arrivals[(h < 0 ? h + 86400 : h) / 3600]++;
+        if (n.slot >= 1 && n.slot <= numSlots) {
+            EodSlot *e = &p->slot[n.slot];
+            e->busySecs += (uint64_t) stay;
+            e->sessions++;
+            e->revenue += n.fee;
+        }
+    }
+}
+
+void eodPartFree(EodPart *p) {
+    if (!p) return;
+    free(p->slot);
+    free(p);
+}
+
+EodPart *eodPartNew() {
+    EodPart *p = calloc(1, sizeof(EodPart));
+    if (p && !(p->slot = calloc((size_t) numSlots + 1, sizeof(EodSlot)))) { free(p); p = NULL; }
+    return p;
+}
+
+/* Scans history as of sn over the given days from day0 on threads
+   workers (the caller is one of them); returns the merged totals, NULL
+   if out of memory. */
+EodPart *eodRun(const Snapshot *sn, time_t day0, int days, int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > HIST_MAX_THREADS) threads = HIST_MAX_THREADS;
+    EodSpan span = { day0, days };
+    EodPart *part[HIST_MAX_THREADS] = { NULL };
+    int ok = 1;
+    for (int t = 0; t < threads && ok; t++) ok = (part[t] = eodPartNew()) != NULL;
+    if (!ok || !histScan(sn, threads, eodFold, &span, (void **) part)) {
+        for (int t = 0; t < threads; t++) eodPartFree(part[t]);
+        return NULL;
+    }
+    EodPart *sum = part[0];
+    for (int t = 1; t < threads; t++) {
+        EodPart *p = part[t];
+        for (int d = 0; d < days; d++) {
+            sum->sessions[d] += p->sessions[d];
+            sum->staySecs[d] += p->staySecs[d];
+            sum->revenue[d] += p->revenue[d];
+        }
+        for (int h = 0; h < 24; h++) sum->arrivals[h] += p->arrivals[h];
+        sum->scanned += p->scanned;
+        sum->open += p->open;
+        sum->earlier += p->earlier;
+        sum->earlierRevenue += p->earlierRevenue;
+        for (int s = 1; s <= numSlots; s++) {
+            sum->slot[s].busySecs += p->slot[s].busySecs;
+            sum->slot[s].sessions += p->slot[s].sessions;
+            sum->slot[s].revenue += p->slot[s].revenue;
+        }
+        eodPartFree(p);
+    }
+    return sum;
+}
+
+/* local midnight days - 1 days before now's */
+time_t eodDay0(time_t now, int days) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_mday -= days - 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+void eodReport(int days) {
+    if (days < 1) days = 1;
+    if (days > EOD_MAX_DAYS) days = EOD_MAX_DAYS;
+    Snapshot *sn = snapshotAcquire();
+    if (!sn) { printf("No snapshot yet.\n"); return; }
+    int threads = histThreads();
+    time_t day0 = eodDay0(clockNow(), days);
+    double t0 = monoSeconds();
+    EodPart *p = eodRun(sn, day0, days, threads);
+    double ms = (monoSeconds() - t0) * 1e3;
+    int revenueNow = sn->totalRevenue;
+    snapshotRelease();
+    if (!p) { printf("Out of memory.\n"); return; }
+    printf("\nEnd of day, last %d day%s: %llu stays scanned on %d thread%s in %.1f ms\n", days, days == 1 ? "" : "s",
+           (unsigned long long) p->scanned, threads, threads == 1 ? "" : "s", ms);
+    int64_t revenue = p->earlierRevenue;
+    for (int d = 0; d < days; d++) {
+        struct tm tm;
+        time_t t = day0 + (time_t) d * 86400 + 43200;
+        char date[16];
+        localtime_r(&t, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+        revenue += p->revenue[d];
+        if (p->sessions[d] == 0 && d < days - 1) continue;
+        printf("  %s %8llu stays  Rs %-9lld avg %5.1f h\n", date, (unsigned long long) p->sessions[d],
+               (long long) p->revenue[d], p->sessions[d] ? p->staySecs[d] / 3600.0 / p->sessions[d] : 0.0);
+    }
+    printf("  earlier %llu stays (Rs %lld), %llu still parked; Rs %lld in history, Rs %d total revenue\n",
+           (unsigned long long) p->earlier, (long long) p->earlierRevenue, (unsigned long long) p->open,
+           (long long) revenue, revenueNow);
+    uint64_t peak = 1;
+    for (int h = 0; h < 24; h++) if (p->arrivals[h] > peak) peak = p->arrivals[h];
+    printf("  arrivals by hour (stays ended in the period):\n");
+    for (int h = 0; h < 24; h++)
+        printf("    %02d:00 %8llu %.*s\n", h, (unsigned long long) p->arrivals[h],
+               (int)(40 * p->arrivals[h] / peak), "########################################");
+    double *busy = malloc((numSlots + 1) * sizeof(double));
+    if (busy) {
+        int top[USE_RANK], low[USE_RANK], nt = 0, nl = 0;
+        long unused = 0;
+        for (int s = 1; s <= numSlots; s++) {
+            busy[s] = (double) p->slot[s].busySecs;
+            unused += p->slot[s].sessions == 0;
+            useRankAdd(top, &nt, s, busy, 1);
+            useRankAdd(low, &nl, s, busy, 0);
+        }
+        printf("  slots: %ld with no stay in the period\n", unused);
+        for (int pass = 0; pass < 2; pass++) {
+            const int *rank = pass ? low : top;
+            printf("  %s\n", pass ? "idlest:" : "busiest:");
+            for (int i = 0; i < (pass ? nl : nt); i++) {
+                const EodSlot *e = &p->slot[rank[i]];
+                printf("    slot %-7d %7u stays %8.1f h  Rs %d\n", rank[i], e->sessions, e->busySecs / 3600.0, e->revenue);
+            }
+        }
+        free(busy);
+    }
+    eodPartFree(p);
+}
+
+/* ----- History queries ----- */
+/* One-off questions over the history ring without a new show* function:
+     [select] AGG[, AGG...] [where FIELD OP VALUE [and ...]] [group by hour|slot|zone]
+   AGG is count, sum(FIELD) or avg(FIELD); FIELD is car, slot, zone,
+   entry, exit, duration, fee, hour (of entry) or open (1 while parked);
+   OP is = != < <= > >=. Durations take an s/m/h/d suffix; times are epoch
+   seconds, YYYY-MM-DD[tHH:MM] local, or relative to the clock (-7d, now).
+   "cars parked over 8 h in zone 2 in the last week" is
+     count where duration > 8h and zone = 2 and entry > -7d
+   A parked car's exit is 0 and its duration runs to the clock. The text
+   compiles to a Query that histScan runs QUERY_BATCH rows at a time: the
+   derived fields the plan uses are computed as columns, each predicate
+   narrows a byte mask in one branch-free pass over its column, and the
+   rows left are summed into the worker's group rows. */
+enum { QF_CAR, QF_SLOT, QF_ZONE, QF_ENTRY, QF_EXIT, QF_DURATION, QF_FEE, QF_HOUR, QF_OPEN, QF_FIELDS };
+static const char *queryFieldName[QF_FIELDS] = { "car", "slot", "zone", "entry", "exit", "duration", "fee", "hour", "open" };
+enum { QO_EQ, QO_NE, QO_LT, QO_LE, QO_GT, QO_GE };
+enum { QA_COUNT, QA_SUM, QA_AVG };
+
+#define QUERY_BATCH 1024
+#define QUERY_MAX_AGGS 8
+#define QUERY_MAX_PREDS 16
+
+typedef struct {
+    int nAgg, aggFn[QUERY_MAX_AGGS], aggField[QUERY_MAX_AGGS];
+    int nPred, predField[QUERY_MAX_PREDS], predOp[QUERY_MAX_PREDS];
+    int64_t predValue[QUERY_MAX_PREDS];
+    int group;          /* QF_HOUR, QF_SLOT, QF_ZONE, or -1 for one row */
+    int groups;
+    uint32_t uses;      /* 1 << QF_* for each field the plan reads */
+    time_t now, midnight;
+} Query;
+
+typedef struct {
+    int64_t *row;       /* groups x (1 + nAgg): count, then each aggregate's sum */
+    uint64_t scanned;
+} QueryPart;
+
+/* next token, lowercased, into tok: a word, a number or time literal, an
+   operator or one of ( ) , *; "" at the end */
+static void queryToken(const char **p, char *tok, size_t n) {
+    const char *s = *p;
+    while (isspace((unsigned char) *s)) s++;
+    size_t k = 0;
+    if (isalpha((unsigned char) *s) || *s == '_') {
+        while ((isalnum((unsigned char) *s) || *s == '_') && k + 1 < n) tok[k++] = (char) tolower((unsigned char) *s++);
+    } else if (isdigit((unsigned char) *s) || ((*s == '-' || *s == '+') && isdigit((unsigned char) s[1]))) {
+        tok[k++] = *s++;
+        while ((isalnum((unsigned char) *s) || *s == ':' || *s == '-') && k + 1 < n) tok[k++] = (char) tolower((unsigned char) *s++);
+    } else if ((*s == '<' || *s == '>' || *s == '!') && s[1] == '=') {
+        tok[k++] = *s++;
+        tok[k++] = *s++;
+    } else if (*s) tok[k++] = *s++;
+    tok[k] = '\0';
+    *p = s;
+}
+
+static int queryFieldByName(const char *name) {
+    for (int f = 0; f < QF_FIELDS; f++) if (strcmp(name, queryFieldName[f]) == 0) return f;
+    return -1;
+}
+
+/* seconds in "90", "15m", "8h", "2d"; 0 if malformed */
+static int queryDuration(const char *tok, int64_t *out) {
+    char *end;
+    long long v = strtoll(tok, &end, 10);
+    long unit = *end == 'd' ? 86400 : *end == 'h' ? 3600 : *end == 'm' ? 60 : 1;
+    if (end == tok || (*end && (end[1] || !strchr("smhd", *end)))) return 0;
+    *out = (int64_t) v * unit;
+    return 1;
+}
+
+/* a literal compared with field f */
+static int queryValue(int f, const char *tok, const Query *q, int64_t *out) {
+    if (f == QF_DURATION) return queryDuration(tok, out);
+    if (f != QF_ENTRY && f != QF_EXIT) {
+        char *end;
+        *out = strtoll(tok, &end, 10);
+        return end != tok && !*end;
+    }
+    if (strcmp(tok, "now") == 0) { *out = q->now; return 1; }
+    if (tok[0] == '-' || tok[0] == '+') {
+        if (!queryDuration(tok + 1, out)) return 0;
+        *out = q->now + (tok[0] == '-' ? -*out : *out);
+        return 1;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int got = sscanf(tok, "%d-%d-%dt%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min);
+    if (got == 3 || got == 5) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        *out = mktime(&tm);
+        return 1;
+    }
+    char *end;
+    *out = strtoll(tok, &end, 10);
+    return end != tok && !*end;
+}
+
+#define QUERY_FAIL(...) do { snprintf(err, errsz, __VA_ARGS__); return 0; } while (0)
+
+/* compiles text into q; 0 with the reason in err if it does not parse */
+int queryCompile(const char *text, Query *q, char *err, size_t errsz) {
+    static const char *opName[] = { "=", "!=", "<", "<=", ">", ">=" };
+    memset(q, 0, sizeof(*q));
+    q->group = -1;
+    q->groups = 1;
+    q->now = clockNow();
+    q->midnight = eodDay0(q->now, 1);
+    const char *p = text;
+    char tok[48];
+    queryToken(&p, tok, sizeof(tok));
+    if (strcmp(tok, "select") == 0) queryToken(&p, tok, sizeof(tok));
+    for (;;) {
+        int fn = strcmp(tok, "count") == 0 ? QA_COUNT : strcmp(tok, "sum") == 0 ? QA_SUM
+               : strcmp(tok, "avg") == 0 ? QA_AVG : -1;
+        if (fn < 0) QUERY_FAIL("expected count, sum or avg, got '%s'", tok);
+        if (q->nAgg == QUERY_MAX_AGGS) QUERY_FAIL("at most %d aggregates", QUERY_MAX_AGGS);
+        int f = -1;
+        const char *save = p;
+        queryToken(&p, tok, sizeof(tok));
+        if (strcmp(tok, "(") == 0) {
+            queryToken(&p, tok, sizeof(tok));
+            if (fn == QA_COUNT && strcmp(tok, "*") == 0) queryToken(&p, tok, sizeof(tok));
+            else if (fn != QA_COUNT) {
+                if ((f = queryFieldByName(tok)) < 0) QUERY_FAIL("unknown field '%s'", tok);
+                queryToken(&p, tok, sizeof(tok));
+            }
+            if (strcmp(tok, ")") != 0) QUERY_FAIL("expected ')', got '%s'", tok);
+        } else if (fn != QA_COUNT) QUERY_FAIL("expected '(' after %s", fn == QA_SUM ? "sum" : "avg");
+        else p = save;
+        q->aggFn[q->nAgg] = fn;
+        q->aggField[q->nAgg++] = f;
+        if (f >= 0) q->uses |= 1u << f;
+        queryToken(&p, tok, sizeof(tok));
+        if (strcmp(tok, ",") != 0) break;
+        queryToken(&p, tok, sizeof(tok));
+    }
+    if (strcmp(tok, "where") == 0) {
+        do {
+            if (q->nPred == QUERY_MAX_PREDS) QUERY_FAIL("at most %d conditions", QUERY_MAX_PREDS);
+            queryToken(&p, tok, sizeof(tok));
+            int f = queryFieldByName(tok), op = -1;
+            if (f < 0) QUERY_FAIL("unknown field '%s'", tok);
+            queryToken(&p, tok, sizeof(tok));
+            for (int o = 0; o < 6; o++) if (strcmp(tok, opName[o]) == 0) op = o;
+            if (op < 0) QUERY_FAIL("expected a comparison after %s, got '%s'", queryFieldName[f], tok);
+            queryToken(&p, tok, sizeof(tok));
+            if (!queryValue(f, tok, q, &q->predValue[q->nPred]))
+                QUERY_FAIL("bad value '%s' for %s", tok, queryFieldName[f]);
+            q->predField[q->nPred] = f;
+            q->predOp[q->nPred++] = op;
+            q->uses |= 1u << f;
+            queryToken(&p, tok, sizeof(tok));
+        } while (strcmp(tok, "and") == 0);
+    }
+    if (strcmp(tok, "group") == 0) {
+        queryToken(&p, tok, sizeof(tok));
+        if (strcmp(tok, "by") != 0) QUERY_FAIL("expected 'by' after group");
+        queryToken(&p, tok, sizeof(tok));
+        q->group = queryFieldByName(tok);
+        if (q->group != QF_HOUR && q->group != QF_SLOT && q->group != QF_ZONE)
+            QUERY_FAIL("can group by hour, slot or zone, not '%s'", tok);
+        q->groups = q->group == QF_HOUR ? 24 : q->group == QF_ZONE ? numZones : numSlots + 1;
+        q->uses |= 1u << q->group;
+        queryToken(&p, tok, sizeof(tok));
+    }
+    if (tok[0]) QUERY_FAIL("unexpected '%s'", tok);
+    return 1;
+}
+
+#define QUERY_FILTER(cmp) for (int i = 0; i < n; i++) keep[i] &= c[i] cmp v
+
+static void queryFold(const Snapshot *sn, Node *nodes, int len, void *part, const void *arg) {
+    const Query *q = arg;
+    QueryPart *qp = part;
+    int64_t col[QF_FIELDS][QUERY_BATCH];
+    uint8_t keep[QUERY_BATCH];
+    int stride = 1 + q->nAgg;
+    for (int base = 0; base < len; base += QUERY_BATCH) {
+        int n = 0, end = base + QUERY_BATCH < len ? base + QUERY_BATCH : len;
+        for (int i = base; i < end; i++) {
+            Node nd;
+            if (!snapHistRead(sn, &nodes[i], &nd)) continue;
+            time_t exit = nd.exitSeq && nd.exitSeq <= sn->seq ? nd.exitTime : 0;
+            col[QF_CAR][n] = nd.car;
+            col[QF_SLOT][n] = nd.slot;
+            col[QF_ENTRY][n] = nd.entryTime;
+            col[QF_EXIT][n] = exit;
+            col[QF_FEE][n] = exit ? nd.fee : 0;
+            col[QF_OPEN][n] = !exit;
+            n++;
+        }
+        qp->scanned += n;
+        if (q->uses & 1u << QF_ZONE)
+            for (int i = 0; i < n; i++) col[QF_ZONE][i] = (col[QF_SLOT][i] - 1) / zoneSpan;
+        if (q->uses & 1u << QF_DURATION)
+            for (int i = 0; i < n; i++) col[QF_DURATION][i] = (col[QF_OPEN][i] ? q->now : col[QF_EXIT][i]) - col[QF_ENTRY][i];
+        if (q->uses & 1u << QF_HOUR)
+            for (int i = 0; i < n; i++) {
+                int64_t h = (col[QF_ENTRY][i] - q->midnight) % 86400;
+                col[QF_HOUR][i] = (h < 0 ? h + 86400 : h) / 3600;
+            }
+        memset(keep, 1, n);
+        for (int k = 0; k < q->nPred; k++) {
+            const int64_t *c = col[q->predField[k]], v = q->predValue[k];
+            switch (q->predOp[k]) {
+                case QO_EQ: QUERY_FILTER(==); break;
+                case QO_NE: QUERY_FILTER(!=); break;
+                case QO_LT: QUERY_FILTER(<); break;
+                case QO_LE: QUERY_FILTER(<=); break;
+                case QO_GT: QUERY_FILTER(>); break;
+                case QO_GE: QUERY_FILTER(>=); break;
+            }
+        }
+        const int64_t *g = q->group >= 0 ? col[q->group] : NULL;
+        for (int i = 0; i < n; i++) {
+            if (!keep[i]) continue;
+            int64_t k = g ? g[i] : 0;
+            if (k < 0 || k >= q->groups) continue;
+            int64_t *r = qp->row + k * stride;
+            r[0]++;
+            for (int a = 0; a < q->nAgg; a++) if (q->aggField[a] >= 0) r[1 + a] += col[q->aggField[a]][i];
+        }
+    }
+}
+
+/* aggregate a of row r, formatted for its field */
+static void queryPrintValue(const Query *q, int a, const int64_t *r) {
+    int f = q->aggField[a];
+    if (q->aggFn[a] == QA_COUNT) { printf(" %14lld", (long long) r[0]); return; }
+    double v = q->aggFn[a] == QA_SUM ? (double) r[1 + a] : r[0] ? (double) r[1 + a] / r[0] : 0;
+    char buf[32];
+    if (f == QF_DURATION) snprintf(buf, sizeof(buf), "%.1f h", v / 3600);
+    else if (f == QF_FEE) snprintf(buf, sizeof(buf), "Rs %.*f", q->aggFn[a] == QA_SUM ? 0 : 1, v);
+    else if ((f == QF_ENTRY || f == QF_EXIT) && q->aggFn[a] == QA_AVG && r[0]) format_time((time_t) v, buf, sizeof(buf));
+    else snprintf(buf, sizeof(buf), "%.*f", q->aggFn[a] == QA_SUM ? 0 : 2, v);
+    printf(" %14s", buf);
+}
+
+/* runs q over history as of sn on threads workers into *out (out->row
+   to be freed by the caller); 0 if out of memory */
+int queryExec(const Snapshot *sn, const Query *q, int threads, QueryPart *out) {
+    int stride = 1 + q->nAgg, ok = 1;
+    QueryPart part[HIST_MAX_THREADS];
+    void *parts[HIST_MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        part[t].scanned = 0;
+        part[t].row = calloc((size_t) q->groups * stride, sizeof(int64_t));
+        parts[t] = &part[t];
+        ok &= part[t].row != NULL;
+    }
+    if (ok) ok = histScan(sn, threads, queryFold, q, parts);
+    for (int t = 1; t < threads; t++) {
+        if (ok) {
+            part[0].scanned += part[t].scanned;
+            for (long k = 0; k < (long) q->groups * stride; k++) part[0].row[k] += part[t].row[k];
+        }
+        free(part[t].row);
+    }
+    if (!ok) free(part[0].row);
+    else *out = part[0];
+    return ok;
+}
+
+void queryRun(const char *text) {
+    Query q;
+    char err[128];
+    if (!queryCompile(text, &q, err, sizeof(err))) { printf("Query error: %s\n", err); return; }
+    int threads = histThreads(), stride = 1 + q.nAgg, ok = 0;
+    QueryPart res = { NULL, 0 };
+    Snapshot *sn = snapshotAcquire();
+    double t0 = monoSeconds();
+    if (sn) {
+        ok = queryExec(sn, &q, threads, &res);
+        snapshotRelease();
+    }
+    double ms = (monoSeconds() - t0) * 1e3;
+    QueryPart *part = &res;
+    if (!sn) printf("No history yet.\n");
+    else if (!ok) printf("Out of memory.\n");
+    else {
+        int64_t matched = 0;
+        for (int k = 0; k < q.groups; k++) matched += part->row[k * stride];
+        printf("\n%lld of %llu stays matched (%d thread%s, %.1f ms)\n", (long long) matched,
+               (unsigned long long) part->scanned, threads, threads == 1 ? "" : "s", ms);
+        printf("  %-8s", q.group >= 0 ? queryFieldName[q.group] : "");
+        for (int a = 0; a < q.nAgg; a++) {
+            char name[32];
+            if (q.aggFn[a] == QA_COUNT) snprintf(name, sizeof(name), "count");
+            else snprintf(name, sizeof(name), "%s(%s)", q.aggFn[a] == QA_SUM ? "sum" : "avg", queryFieldName[q.aggField[a]]);
+            printf(" %14s", name);
+        }
+        printf("\n");
+        for (int k = 0; k < q.groups; k++) {
+            const int64_t *r = part->row + k * stride;
+            if (q.group >= 0 && r[0] == 0) continue;
+            if (q.group == QF_HOUR) printf("  %02d:00   ", k);
+            else if (q.group >= 0) printf("  %-8d", k);
+            else printf("  %-8s", "all");
+            for (int a = 0; a < q.nAgg; a++) queryPrintValue(&q, a, r);
+            printf("\n");
+        }
+    }
+    free(res.row);
+}
+
+/* ----- Overstay detection ----- */
+/* Parked cars sit in one of two indexed d-ary min-heaps keyed by entry
+   time: stayWatch until they pass --overstay, stayFlagged after that.
+   Entries arrive in time order, so an insert rarely sifts; an exit finds
+   its car through CarHot.stayPos and removes it in O(log n). A check
+   moves overdue tops across, O(log n) per newly flagged car and O(1)
+   otherwise, and never walks the cars. */
+typedef struct {
+    uint64_t *key;      /* biased entryRel << 32 | car */
+    int size, cap;
+} StayHeap;
+
+StayHeap stayWatch, stayFlagged;
+Region stayRegion;
+long overstayLimit = 0;         /* --overstay, seconds; 0: no alerts */
+int overstayClose = 0;          /* --overstay-close: check overdue cars out */
+uint64_t overstayTimer;         /* sweep timer for the oldest watched car */
+time_t overstayDue;
+
+static inline uint64_t stayKey(int car) {
+    return (uint64_t)((uint32_t) carHot[car].entryRel ^ 0x80000000u) << 32 | (uint32_t) car;
+}
+
+static inline void staySet(StayHeap *h, int k, uint64_t key) {
+    h->key[k] = key;
+    carHot[(uint32_t) key].stayPos = k;
+}
+
+static void staySiftUp(StayHeap *h, int k, uint64_t key) {
+    while (k > 0) {
+        int parent = (k - 1) / HEAP_ARITY;
+        if (h->key[parent] <= key) break;
+        staySet(h, k, h->key[parent]);
+        k = parent;
+    }
+    staySet(h, k, key);
+}
+
+static void staySiftDown(StayHeap *h, int k, uint64_t key) {
+    for (;;) {
+        int c = HEAP_ARITY * k + 1, best = -1;
+        for (int j = 0; j < HEAP_ARITY && c + j < h->size; j++)
+            if (best < 0 || h->key[c + j] < h->key[best]) best = c + j;
+        if (best < 0 || h->key[best] >= key) break;
+        staySet(h, k, h->key[best]);
+        k = best;
+    }
+    staySet(h, k, key);
+}
+
+static inline void stayInsert(StayHeap *h, int car) {
+    if (h->size < h->cap) staySiftUp(h, h->size++, stayKey(car));
+}
+
+static inline void stayRemove(StayHeap *h, int car) {
+    int k = carHot[car].stayPos;
+    carHot[car].stayPos = -1;
+    if (k < 0 || k >= h->size) return;
+    uint64_t last = h->key[--h->size];
+    if (k == h->size) return;
+    if (k > 0 && h->key[(k - 1) / HEAP_ARITY] > last) staySiftUp(h, k, last);
+    else staySiftDown(h, k, last);
+}
+
+/* the heap a parked car is in */
+static inline StayHeap *stayHeapOf(int car) {
+    return carHot[car].flags & CAR_F_OVERSTAY ? &stayFlagged : &stayWatch;
+}
+
+int stayAlloc() {
+    stayWatch.key = tableAlloc(&stayRegion, 2 * (size_t) numSlots * sizeof(uint64_t));
+    if (!stayWatch.key) return 0;
+    stayFlagged.key = stayWatch.key + numSlots;
+    stayWatch.cap = stayFlagged.cap = numSlots;
+    stayWatch.size = stayFlagged.size = 0;
+    return 1;
+}
+
+void stayFree() {
+    tableFree(&stayRegion);
+    stayWatch.key = stayFlagged.key = NULL;
+    stayWatch.size = stayFlagged.size = 0;
+}
+
+/* collects the cars of h[k]'s subtree that entered at or before due
+   (biased), pruning at the first later root; O(found * HEAP_ARITY) */
+static int stayCollect(const StayHeap *h, int k, uint32_t due, uint64_t *out, int n) {
+    if (k >= h->size || (uint32_t)(h->key[k] >> 32) > due) return n;
+    out[n++] = h->key[k];
+    for (int j = 1; j <= HEAP_ARITY; j++) n = stayCollect(h, HEAP_ARITY * k + j, due, out, n);
+    return n;
+}
+
+static int cmpU64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* ----- Slot holds (--hold SECONDS) ----- */
+/* With holds on, a slot freed while cars wait is not parked on the head
+   of the queue outright: it is offered and held for holdSecs, and the car
+   takes it by coming through the entry gate. An exit while holding
+   declines; a lapsed offer moves on to the next waiting car. The slot
+   keeps the car under SLOT_F_HELD, the car sits at -3 with the slot in
+   CarHot.offer, and each open offer owns one wheel timer, so making,
+   taking and expiring an offer are all O(1). */
+long holdSecs = 0;
+uint64_t *holdTimer;            /* slot -> expiry timer, 0 if not held */
+
+void expireAt(int32_t slot, time_t now);
+TimerFn holdFire = expireAt;    /* what a lapsed offer runs; the property test swaps in a quiet one */
+
+int holdAlloc() {
+    if (holdSecs <= 0) return 1;
+    holdTimer = calloc(numSlots + 1, sizeof(uint64_t));
+    return holdTimer != NULL;
+}
+
+void holdFree() {
+    free(holdTimer);
+    holdTimer = NULL;
+}
+
+/* ----- Trace recording (--trace FILE) ----- */
+/* Every gate input (entry, exit, pass, emergency, policy switch, lapsed
+   offer, late-event correction) is recorded with its
+   timestamp and its outcome, so --replay can rerun it on a virtual clock
+   and point at the first input whose outcome differs. Each thread
+   appends to its own ring; a background thread drains the rings into
+   the file, so recording costs a handful of stores per input. Records
+   carry a global sequence number and are put back in order on replay.
+   Every traceCheckEvery inputs a digest of the whole state is recorded
+   as a checkpoint, which catches divergence that has not (yet) changed
+   any outcome. */
+enum { TR_ENTRY = 1, TR_EXIT, TR_PASS, TR_EMERGENCY, TR_CHECK, TR_POLICY, TR_EXPIRE, TR_AMEND };
+
+typedef struct {
+    uint8_t op;         /* TR_* */
+    uint8_t status;     /* GATE_* outcome of an entry or exit */
+    uint16_t position;  /* queue position after GATE_QUEUED; TR_ENTRY/TR_EXIT amended for TR_AMEND */
+    int32_t car;
+    int64_t time;       /* input time; the state digest for TR_CHECK */
+    uint64_t seq;       /* global input order */
+    int32_t slot;       /* slot taken or freed, -1 if none; policy for TR_POLICY */
+    int32_t fee;
+    int32_t nextCar;    /* waiting car handed the freed slot, -1 if none */
+    int32_t nextSlot;
+} TraceRec;
+
+#define TRACE_MAGIC "DSTRACE3"
+/* header ends before holdSecs: no holds */
+#define TRACE_MAGIC_V2 "DSTRACE2"
+/* header ends before policy: all zones lowest-first, and checkpoints
+   digest less state than stateDigest now does, so they are skipped */
+#define TRACE_MAGIC_V1 "DSTRACE1"
+
+typedef struct {
+    char magic[8];
+    int32_t numSlots, numCars, numZones, checkEvery;
+    int64_t histCap;
+    int64_t epoch;      /* slotEpoch */
+    uint8_t policy[MAX_ZONES];  /* each zone's policy when recording began */
+    int32_t holdSecs;   /* --hold */
+} TraceHeader;
+
+#define TRACE_RING 16384    /* records per thread ring */
+
+typedef struct TraceRing {
+    TraceRec recs[TRACE_RING];
+    _Atomic uint64_t head __attribute__((aligned(CACHE_LINE)));  /* owner writes */
+    _Atomic uint64_t tail __attribute__((aligned(CACHE_LINE)));  /* flusher drains */
+    struct TraceRing *next;
+} TraceRing;
+
+int traceOn = 0;
+int traceCheckEvery = 65536;        /* --trace-check */
+LogWriter *traceWriter = NULL;
+TraceRing *traceRings = NULL;       /* under traceLock */
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t traceThread;
+_Atomic int traceStop = 0;
+_Atomic uint64_t traceSeq = 0;
+_Atomic long traceLost = 0;
+_Thread_local TraceRing *traceMine = NULL;
+
+/* 64-bit FNV-1a over whole words */
+uint64_t digestMix(uint64_t h, uint64_t w) {
+    return (h ^ w) * 0x100000001b3ull;
+}
+
+/* Digest of everything an input can change: slot states and usage, car
+   records, each zone's policy, free set and queue order, revenue and the
+   history. */
+uint64_t stateDigest() {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int s = 1; s <= numSlots; s++) {
+        h = digestMix(h, (uint64_t) slotState[s].car << 32 | (uint32_t) slotState[s].entryRel);
+        h = digestMix(h, (uint64_t) slotUse[s].sessions << 32 | slotUse[s].busySecs);
+    }
+    for (int c = 0; c < numCars; c++) {
+        const CarHot *ch = &carHot[c];
+        h = digestMix(h, (uint64_t)(uint32_t) ch->slot << 32 | (uint32_t) ch->entryRel);
+        /* CAR_F_OVERSTAY is set by checks, which are not inputs */
+        h = digestMix(h, (uint64_t)(ch->flags & ~CAR_F_OVERSTAY) << 32 ^ (ch->session ? ch->session->id : 0));
+    }
+    for (int z = 0; z < numZones; z++) {
+        SlotHeap *hp = &zones[z].heap;
+        h = digestMix(h, (uint64_t) hp->size);
+        for (int k = 0; k < hp->size; k++) h = digestMix(h, (uint64_t) hp->arr[k + HEAP_ARITY - 1]);
+        KeyHeap *kh = &zones[z].keyed;
+        for (int k = 0; k < kh->size; k++) h = digestMix(h, kh->arr[k + HEAP_ARITY - 1]);
+        SlotRing *rg = &zones[z].ring;
+        for (int i = 0, idx = rg->head; i < rg->count; i++, idx = idx + 1 < rg->cap ? idx + 1 : 0)
+            h = digestMix(h, (uint64_t) rg->q[idx]);
+        h = digestMix(h, (uint64_t) zones[z].policy << 32 | (uint32_t) zones[z].cursor);
+        WaitQueue *w = &zones[z].wait;
+        h = digestMix(h, (uint64_t) w->count);
+        for (int i = 0, idx = w->front; i < w->count; i++, idx = (idx + 1) % WAIT_CAP)
+            h = digestMix(h, (uint64_t) w->q[idx]);
+    }
+    h = digestMix(h, (uint64_t) totalRevenue);
+    for (Node *n = history; n; n = n->next) {
+        h = digestMix(h, (uint64_t)(uint32_t) n->car << 32 | (uint32_t) n->slot);
+        h = digestMix(h, (uint64_t) n->entryTime);
+        h = digestMix(h, (uint64_t) n->exitTime);
+        h = digestMix(h, n->id);
+    }
+    return h;
+}
+
+void tracePut(const TraceRec *rec) {
+    TraceRing *r = traceMine;
+    if (!r) {
+        r = traceMine = calloc(1, sizeof(TraceRing));
+        if (!r) { atomic_fetch_add(&traceLost, 1); return; }
+        pthread_mutex_lock(&traceLock);
+        r->next = traceRings;
+        traceRings = r;
+        pthread_mutex_unlock(&traceLock);
+    }
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&r->tail, memory_order_acquire) == TRACE_RING) sched_yield();
+    r->recs[head % TRACE_RING] = *rec;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* records one input (rec->seq is assigned here), then a checkpoint if due */
+void traceInput(TraceRec *rec) {
+    rec->seq = atomic_fetch_add_explicit(&traceSeq, 1, memory_order_relaxed);
+    tracePut(rec);
+    if (traceCheckEvery && (rec->seq + 1) % (uint64_t) traceCheckEvery == 0) {
+        TraceRec chk = { TR_CHECK, 0, 0, -1, (int64_t) stateDigest(), 0, -1, 0, -1, -1 };
+        chk.seq = atomic_fetch_add_explicit(&traceSeq, 1, memory_order_relaxed);
+        tracePut(&chk);
+    }
+}
+
+/* pass and emergency inputs have no outcome beyond the state change */
+void traceSimple(int op, int car, time_t t) {
+    if (!traceOn) return;
+    TraceRec rec = { (uint8_t) op, 0, 0, car, (int64_t) t, 0, -1, 0, -1, -1 };
+    traceInput(&rec);
+}
+
+/* a zone's policy, in the car field, switched to the one in the slot field */
+void tracePolicy(int z, int policy, time_t t) {
+    if (!traceOn) return;
+    TraceRec rec = { TR_POLICY, 0, 0, z, (int64_t) t, 0, policy, 0, -1, -1 };
+    traceInput(&rec);
+}
+
+void *traceFlusher(void *arg) {
+    (void) arg;
+    for (;;) {
+        int stop = atomic_load(&traceStop);
+        long moved = 0;
+        pthread_mutex_lock(&traceLock);
+        for (TraceRing *r = traceRings; r; r = r->next) {
+            uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+            for (; tail < head; tail++, moved++)
+                logAppend(traceWriter, &r->recs[tail % TRACE_RING], sizeof(TraceRec));
+            atomic_store_explicit(&r->tail, tail, memory_order_release);
+        }
+        pthread_mutex_unlock(&traceLock);
+        if (stop && !moved) break;  /* producers had stopped before this pass */
+        if (!moved) {
+            struct timespec ts = { 0, 1000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* called after initSystem, so the header carries the final geometry */
+int traceOpen(const char *path) {
+    traceWriter = logOpen(path, 1);
+    if (!traceWriter) return 0;
+    TraceHeader hd;
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, TRACE_MAGIC, 8);
+    hd.numSlots = numSlots;
+    hd.numCars = numCars;
+    hd.numZones = numZones;
+    hd.checkEvery = traceCheckEvery;
+    hd.histCap = histCap;
+    hd.epoch = (int64_t) slotEpoch;
+    for (int z = 0; z < numZones; z++) hd.policy[z] = (uint8_t) zones[z].policy;
+    hd.holdSecs = (int32_t) holdSecs;
+    logAppend(traceWriter, &hd, sizeof(hd));
+    atomic_store(&traceStop, 0);
+    atomic_store(&traceSeq, 0);
+    if (pthread_create(&traceThread, NULL, traceFlusher, NULL) != 0) {
+        logClose(traceWriter);
+        traceWriter = NULL;
+        return 0;
+    }
+    traceOn = 1;
+    return 1;
+}
+
+/* once every recording thread is done */
+int traceClose() {
+    if (!traceWriter) return 1;
+    traceOn = 0;
+    atomic_store(&traceStop, 1);
+    pthread_join(traceThread, NULL);
+    int ok = logClose(traceWriter) && atomic_load(&traceLost) == 0;
+    traceWriter = NULL;
+    while (traceRings) {
+        TraceRing *r = traceRings;
+        traceRings = r->next;
+        free(r);
+    }
+    traceMine = NULL;
+    return ok;
+}
+
+/* ----- Invariant checks (--check) ----- */
+/* The tables must agree with each other: a parked car and its slot point
+   at each other, a car marked -2 sits in the queue it is marked for exactly
+   once, every free slot is in its zone's heap exactly once, heaps are
+   ordered with HEAP_EMPTY padding, nobody waits while a slot is free,
+   and the history ring accounts for every fee charged. checkAll
+   verifies all of it in O(slots + cars + history). checkEvent only
+   looks at what one gate event touched (the car, its slot, the heap path
+   that moved, the queue it used). --check incremental runs it after
+   handoffs, queueing, failures, expiries and corrections. Every plain
+   entry and exit gets an O(1) test of the lines the event loaded
+   (checkQuickEntry, checkQuickExit), which keeps it cheap enough to
+   leave on; if that fails, or for 1 in CHECK_DEEP, checkEvent runs too. */
+enum { CHECK_OFF, CHECK_INCREMENTAL, CHECK_FULL };
+
+int checkMode = CHECK_OFF;
+long checkFailures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+        if (__builtin_expect(!(cond), 0) && !bad++)             \
+            snprintf(err, errsz, __VA_ARGS__);                  \
+    } while (0)
+
+/* car c parked at slot s, both ways round */
+int checkParked(int c, int s, char *err, size_t errsz) {
+    int bad = 0;
+    CHECK(s >= 1 && s <= numSlots, "car %d has slot %d out of range", c, s);
+    if (bad) return bad;
+    CHECK(slotCar(s) == c, "car %d says slot %d, slot says car %d", c, s, slotCar(s));
+    CHECK(slotState[s].entryRel == carHot[c].entryRel, "car %d and slot %d disagree on entry time", c, s);
+    const Node *n = carHot[c].session;
+    CHECK(!n || (n->car == c && n->slot == s && n->exitTime == 0), "car %d's history record is not its open session", c);
+    const StayHeap *sh = stayHeapOf(c);
+    int k = carHot[c].stayPos;
+    CHECK(k >= 0 && k < sh->size && sh->key[k] == stayKey(c), "car %d is not at its place %d in the overstay heap", c, k);
+    return bad;
+}
+
+/* slot s held for car c, both ways round, with its expiry pending */
+int checkHeld(int c, int s, char *err, size_t errsz) {
+    int bad = 0;
+    CHECK(s >= 1 && s <= numSlots, "car %d offered slot %d out of range", c, s);
+    if (bad) return bad;
+    CHECK(carHot[c].slot == -3 && carHot[c].offer == s, "car %d offered slot %d but marked %d/%d", c, s,
+          carHot[c].slot, carHot[c].offer);
+    CHECK(slotHeld(s) && slotCar(s) == c, "slot %d offered to car %d but says %08x", s, c, slotState[s].car);
+    CHECK(holdTimer && timerPending(holdTimer[s]), "slot %d held for car %d with no expiry pending", s, c);
+    CHECK(carHot[c].stayPos == -1 && !carHot[c].session, "car %d holding an offer has a stay open", c);
+    return bad;
+}
+
+/* queue w: in range, no duplicates, everyone in it marked waiting here */
+int checkQueue(const Zone *z, char *err, size_t errsz) {
+    int bad = 0;
+    const WaitQueue *w = &z->wait;
+    CHECK(w->count >= 0 && w->count <= WAIT_CAP, "zone %d queue count %d", (int)(z - zones), w->count);
+    if (bad) return bad;
+    for (int i = 0, idx = w->front; i < w->count; i++, idx = (idx + 1) % WAIT_CAP) {
+        int c = w->q[idx];
+        CHECK(c >= 0 && c < numCars, "zone %d queue holds car id %d", (int)(z - zones), c);
+        if (c < 0 || c >= numCars) continue;
+        CHECK(carHot[c].slot == -2, "car %d queued but marked %d", c, carHot[c].slot);
+        CHECK(carHot[c].waitZone == z - zones, "car %d in zone %d's queue but marked for zone %d", c, (int)(z - zones),
+              carHot[c].waitZone);
+        for (int j = i + 1, jdx = (idx + 1) % WAIT_CAP; j < w->count; j++, jdx = (jdx + 1) % WAIT_CAP)
+            CHECK(w->q[jdx] != c, "car %d queued twice in zone %d", c, (int)(z - zones));
+    }
+    return bad;
+}
+
+/* the history ring: every parked car's open stay is in it, its fees
+   plus those recycled out of it add up to totalRevenue, and no two stays
+   on a slot overlap. The list runs newest first and a slot's stays are
+   recorded in the order they took it (an open one moved to the newest
+   end is still its slot's latest), so each stay must end by the time
+   the one after it on its slot began. */
+int checkHistory(char *err, size_t errsz) {
+    int bad = 0;
+    time_t *next = malloc((numSlots + 1) * sizeof(time_t));
+    if (!next) {
+        snprintf(err, errsz, "out of memory");
+        return 1;
+    }
+    for (int s = 0; s <= numSlots; s++) next[s] = (time_t) INT64_MAX;
+    for (const Node *n = history; n; n = n->next) {
+        if (n->slot < 1 || n->slot > numSlots) {
+            CHECK(0, "car %d's stay is on slot %d out of range", n->car, n->slot);
+            continue;
+        }
+        time_t after = next[n->slot];
+        if (after != (time_t) INT64_MAX) CHECK(n->exitTime && n->exitTime <= after, "slot %d: car %d's stay runs past the next one's start",
+                         n->slot, n->car);
+        next[n->slot] = n->entryTime;
+    }
+    free(next);
+    int64_t fees = histDropped;
+    int open = 0, parked = 0;
+    for (const HistSeg *seg = histSegs; seg; seg = seg->next)
+        for (int i = 0; i < seg->used; i++) {
+            const Node *n = &seg->nodes[i];
+            fees += n->fee;
+            open += n->car >= 0 && n->car < numCars && carHot[n->car].session == n;
+        }
+    for (int c = 0; c < numCars; c++) {
+        const Node *n = carCold[c].lastStay;
+        parked += carHot[c].session != NULL;
+        CHECK(!n || (n->car == c && n->exitTime), "car %d's last stay record is not a closed stay of its own", c);
+    }
+    CHECK(open == parked, "%d parked cars have a stay open, %d of them in the history ring", parked, open);
+    CHECK(fees == totalRevenue, "history fees Rs %lld (Rs %lld recycled) but revenue Rs %d",
+          (long long) fees, (long long) histDropped, totalRevenue);
+    return bad;
+}
+
+int checkAll(char *err, size_t errsz) {
+    int bad = 0;
+    unsigned char *inHeap = calloc(numSlots + 1, 1);
+    unsigned char *queued = calloc(numCars, 1);
+    if (!inHeap || !queued) {
+        free(inHeap); free(queued);
+        snprintf(err, errsz, "out of memory");
+        return 1;
+    }
+    int anyFree = 0, anyWaiting = 0;
+    for (int z = 0; z < numZones; z++) {
+        const Zone *zn = &zones[z];
+        const SlotHeap *h = &zn->heap;
+        const int *a = h->arr + HEAP_ARITY - 1;
+        CHECK(h->size >= 0 && h->size <= h->cap, "zone %d heap size %d of %d", z, h->size, h->cap);
+        if (h->size < 0 || h->size > h->cap) continue;
+        for (int i = 0; i < HEAP_ARITY - 1; i++) CHECK(h->arr[i] == HEAP_EMPTY, "zone %d heap lead padding", z);
+        for (int k = h->size; k < HEAP_STORE_LEN(h->cap, HEAP_ARITY) - (HEAP_ARITY - 1); k++)
+            CHECK(a[k] == HEAP_EMPTY, "zone %d heap position %d past the end is %d", z, k, a[k]);
+        for (int k = 0; k < h->size; k++) {
+            int s = a[k];
+            CHECK(s >= zn->first && s <= zn->last, "zone %d heap holds slot %d outside the zone", z, s);
+            if (s < zn->first || s > zn->last) continue;
+            CHECK(!inHeap[s], "slot %d in the heap twice", s);
+            inHeap[s] = 1;
+            CHECK(slotState[s].car == SLOT_FREE, "slot %d in the heap but taken by car %d", s, slotCar(s));
+            if (k > 0) CHECK(a[(k - 1) / HEAP_ARITY] <= s, "zone %d heap out of order at %d", z, k);
+        }
+        if (zn->policy != ALLOC_LOWEST)
+            CHECK(h->size == 0, "zone %d is %s but its slot heap holds %d", z, allocPolicyName[zn->policy], h->size);
+        if (policyKeyed(zn->policy)) {
+            const KeyHeap *u = &zn->keyed;
+            const uint64_t *ka = u->arr + HEAP_ARITY - 1;
+            CHECK(u->size >= 0 && u->size <= u->cap, "zone %d key heap size %d of %d", z, u->size, u->cap);
+            for (int k = 0; k < u->size && u->size <= u->cap; k++) {
+                int s = zn->first + (int)(ka[k] & ((1u << KEY_SLOT_BITS) - 1));
+                CHECK(s <= zn->last, "zone %d key heap holds slot %d outside the zone", z, s);
+                if (s > zn->last) continue;
+                CHECK(!inHeap[s], "slot %d in the key heap twice", s);
+                inHeap[s] = 1;
+                CHECK(slotState[s].car == SLOT_FREE, "slot %d in the key heap but taken by car %d", s, slotCar(s));
+                CHECK(ka[k] == freeKey(zn, s), "slot %d keyed %llx, expected %llx", s,
+                      (unsigned long long) ka[k], (unsigned long long) freeKey(zn, s));
+                if (k > 0) CHECK(ka[(k - 1) / HEAP_ARITY] <= ka[k], "zone %d key heap out of order at %d", z, k);
+            }
+        }
+        if (zn->policy == ALLOC_LRU) {
+            const SlotRing *r = &zn->ring;
+            CHECK(r->count >= 0 && r->count <= r->cap && r->head >= 0 && r->head < r->cap,
+                  "zone %d ring holds %d from %d of %d", z, r->count, r->head, r->cap);
+            for (int i = 0, idx = r->head; i < r->count && r->count <= r->cap; i++, idx = idx + 1 < r->cap ? idx + 1 : 0) {
+                int s = r->q[idx];
+                CHECK(s >= zn->first && s <= zn->last, "zone %d ring holds slot %d outside the zone", z, s);
+                if (s < zn->first || s > zn->last) continue;
+                CHECK(!inHeap[s], "slot %d in the ring twice", s);
+                inHeap[s] = 1;
+                CHECK(slotState[s].car == SLOT_FREE, "slot %d in the ring but taken by car %d", s, slotCar(s));
+            }
+        }
+        anyFree |= zoneFreeCount(zn) > 0;
+        anyWaiting |= zn->wait.count > 0;
+        bad += checkQueue(zn, bad ? NULL : err, bad ? 0 : errsz);
+        for (int i = 0, idx = zn->wait.front; i < zn->wait.count && i < WAIT_CAP; i++, idx = (idx + 1) % WAIT_CAP) {
+            int c = zn->wait.q[idx];
+            if (c >= 0 && c < numCars) queued[c] = 1;
+        }
+    }
+    for (int s = 1; s <= numSlots; s++) {
+        if (slotState[s].car == SLOT_FREE) {
+            CHECK(inHeap[s], "slot %d is free but not in its zone's free set", s);
+        } else if (slotHeld(s)) {
+            int c = slotCar(s);
+            CHECK(c < numCars && carHot[c].slot == -3 && carHot[c].offer == s, "slot %d held for car %d, which has no such offer", s, c);
+        } else {
+            int c = slotCar(s);
+            CHECK(c < numCars && carHot[c].slot == s, "slot %d says car %d, which is not parked there", s, c);
+        }
+    }
+    int parked = 0;
+    for (const StayHeap *sh = &stayWatch; sh; sh = sh == &stayWatch ? &stayFlagged : NULL)
+        for (int k = 1; k < sh->size; k++)
+            CHECK(sh->key[(k - 1) / HEAP_ARITY] <= sh->key[k], "overstay heap out of order at %d", k);
+    for (int c = 0; c < numCars; c++) {
+        int s = carHot[c].slot;
+        parked += s >= 1;
+        if (s < 1) CHECK(carHot[c].stayPos == -1, "car %d is away but still in an overstay heap", c);
+        if (s != -3) CHECK(carHot[c].offer == 0, "car %d marked %d still holds an offer of slot %d", c, s, carHot[c].offer);
+        if (s >= 1) bad += checkParked(c, s, bad ? NULL : err, bad ? 0 : errsz);
+        else if (s == -3) bad += checkHeld(c, carHot[c].offer, bad ? NULL : err, bad ? 0 : errsz);
+        else if (s == -2) CHECK(queued[c], "car %d marked waiting but in no queue", c);
+        else CHECK(s == -1 && !carHot[c].session, "car %d absent but marked %d", c, s);
+    }
+    CHECK(stayWatch.size + stayFlagged.size == parked, "overstay heaps hold %d cars, %d are parked",
+          stayWatch.size + stayFlagged.size, parked);
+    CHECK(!(anyFree && anyWaiting), "cars are waiting while slots are free");
+    CHECK(totalRevenue >= 0, "revenue %d", totalRevenue);
+    bad += checkHistory(bad ? NULL : err, bad ? 0 : errsz);
+    free(inHeap);
+    free(queued);
+    return bad;
+}
+
+/* violations go to stderr, the first few in full */
+void checkReport(const char *what, int car, int bad, const char *err) {
+    if (!bad) return;
+    if (checkFailures++ < 10) fprintf(stderr, "Invariant violated after %s of car %d: %s\n", what, car, err);
+}
+
+void checkFull(const char *what, int car) {
+    char err[160];
+    err[0] = '\0';
+    checkReport(what, car, checkAll(err, sizeof(err)), err);
+}
+
+void showInvariants() {
+    char err[160];
+    err[0] = '\0';
+    int bad = checkAll(err, sizeof(err));
+    if (!bad) printf("State consistent: slots, cars, heaps, queues and history agree.\n");
+    else printf("%d invariant violation%s, first: %s\n", bad, bad == 1 ? "" : "s", err);
+}
+
+/* heap order from the root down the min-child path, where RemoveMin
+   sifted, and (if want >= 0) that want lies on the last leaf's
+   ancestor path, where Insert sifted */
+int checkHeapPaths(const Zone *zn, int want, char *err, size_t errsz) {
+    int bad = 0;
+    if (zn->policy == ALLOC_LRU) {
+        /* a release goes to the back of the ring */
+        const SlotRing *r = &zn->ring;
+        int back = r->head + r->count - 1;
+        if (want >= 0)
+            CHECK(r->count > 0 && r->q[back < r->cap ? back : back - r->cap] == want,
+                  "freed slot %d is not at the back of zone %d's ring", want, (int)(zn - zones));
+        return bad;
+    }
+    if (policyKeyed(zn->policy)) {
+        const KeyHeap *u = &zn->keyed;
+        const uint64_t *ka = u->arr + HEAP_ARITY - 1;
+        for (int k = 0; k < u->size; ) {
+            int c = HEAP_ARITY * k + 1, best = -1;
+            for (int j = 0; j < HEAP_ARITY && c + j < u->size; j++) {
+                CHECK(ka[k] <= ka[c + j], "zone %d key heap out of order below %d", (int)(zn - zones), k);
+                if (best < 0 || ka[c + j] < ka[best]) best = c + j;
+            }
+            if (best < 0) break;
+            k = best;
+        }
+        if (want >= 0) {
+            uint64_t key = freeKey(zn, want);
+            int found = 0;
+            for (int k = u->size - 1; k >= 0 && !found; k = k ? (k - 1) / HEAP_ARITY : -1) found = ka[k] == key;
+            CHECK(found, "freed slot %d did not reach zone %d's key heap", want, (int)(zn - zones));
+        }
+        return bad;
+    }
+    const SlotHeap *h = &zn->heap;
+    const int *a = h->arr + HEAP_ARITY - 1;
+    for (int k = 0; k < h->size; ) {
+        int c = HEAP_ARITY * k + 1, best = -1;
+        for (int j = 0; j < HEAP_ARITY && c + j < h->size; j++) {
+            CHECK(a[k] <= a[c + j], "zone %d heap out of order below %d", (int)(zn - zones), k);
+            if (best < 0 || a[c + j] < a[best]) best = c + j;
+        }
+        if (best < 0) break;
+        k = best;
+    }
+    if (want >= 0) {
+        int found = 0;
+        for (int k = h->size - 1; k >= 0 && !found; k = k ? (k - 1) / HEAP_ARITY : -1) found = a[k] == want;
+        CHECK(found, "freed slot %d did not reach zone %d's heap", want, (int)(zn - zones));
+    }
+    return bad;
+}
+
+/* ----- System initialization & functions ----- */
+Region slotRegion, useRegion, carHotRegion;
+
+int allocTables() {
+    slotState = tableAlloc(&slotRegion, (numSlots + 1) * sizeof(SlotState));
+    slotUse = tableAlloc(&useRegion, (numSlots + 1) * sizeof(SlotUse));
+    if (slotUse) memset(slotUse, 0, (numSlots + 1) * sizeof(SlotUse));
+    carHot = tableAlloc(&carHotRegion, numCars * sizeof(CarHot));
+    carCold = malloc(numCars * sizeof(CarCold));  /* off the gate path: normal pages */
+    slotFreed = malloc((numSlots + 1) * sizeof(int32_t));
+    if (!slotState || !slotUse || !carHot || !carCold || !slotFreed || !histAlloc() || !dwellAlloc() || !occAlloc() || !stayAlloc()
+        || !holdAlloc() || !timerReset(0, TIMER_SPARE + (holdTimer ? numSlots : 0)))
+        return 0;
+    slotRelease(0);
+    layoutZones();
+    placeZones();
+    zonesRunOnWorkers(zoneAlloc, NULL);
+    for (int z = 0; z < numZones; z++) if (!zones[z].ok) return 0;
+    return 1;
+}
+
+void freeTables() {
+    zonesRunOnWorkers(zoneFree, NULL);
+    tableFree(&slotRegion);
+    tableFree(&useRegion);
+    tableFree(&carHotRegion);
+    free(carCold);
+    carCold = NULL;
+    free(slotFreed);
+    slotFreed = NULL;
+    free(dwellCells);
+    dwellCells = NULL;
+    occFree();
+    stayFree();
+    holdFree();
+    timerFree();
+    snapshotQuiesce();
+    histFree();
+}
+
+void reportPages() {
+    printf("Huge pages: heap %s, slots %s, cars %s, history %s\n",
+           pagesName(zones[0].heapRegion.pages), pagesName(slotRegion.pages),
+           pagesName(carHotRegion.pages), pagesName(histPages));
+}
+
+void initSystem() {
+    ownerThread = pthread_self();
+    snapshotQuiesce();
+    for (int i = 0; i < SNAP_PREALLOC; i++) {
+        Snapshot *sn = snapshotAlloc();
+        if (!sn) break;
+        sn->next = spareSnaps;
+        spareSnaps = sn;
+    }
+    freeScan = pickFreeScan();
+    slotEpoch = clockNow();
+    for (int i = 0; i < numCars; i++) {
+        carHot[i] = (CarHot){ NULL, -1, 0, 0, -1, 0, 0 };
+        memset(&carCold[i], 0, sizeof(CarCold));
+    }
+    memset(slotUse, 0, (numSlots + 1) * sizeof(SlotUse));
+    for (int s = 0; s <= numSlots; s++) slotFreed[s] = INT32_MIN;
+    useSince = slotEpoch;
+    stayWatch.size = stayFlagged.size = 0;
+    timerReset(clockNow(), 0);
+    overstayTimer = 0;
+    if (holdTimer) memset(holdTimer, 0, (numSlots + 1) * sizeof(uint64_t));
+    for (int z = 0; z < numZones; z++) zoneReset(&zones[z]);
+    totalRevenue = 0;
+    histReset();
+    dwellReset();
+    occReset();
+}
+
+void showSlotMap() {
+    Snapshot *sn = snapshotAcquire();
+    if (!sn) return;
+    printf("\n Slot Map (%d/%d free) \n", sn->freeCount, sn->numSlots);
+    for (int s = 1; s <= sn->numSlots; s++) {
+        uint32_t c = sn->slots[s].car;
+        if (c == SLOT_FREE) printf("Slot %d: [Empty]\n", s);
+        else if (c & SLOT_F_HELD) printf("Slot %d: [Held for Car %u]\n", s, c & SLOT_CAR_MASK);
+        else printf("Slot %d: [Car %u]\n", s, c & SLOT_CAR_MASK);
+    }
+    snapshotRelease();
+}
+
+void searchCar(int car) {
+    if (car < 0 || car >= numCars) { printf("Invalid car id.\n"); return; }
+    if (carCold[car].plate[0]) printf("Plate %s", carCold[car].plate);
+    if (carCold[car].account[0]) printf("%sAccount %s", carCold[car].plate[0] ? ", " : "", carCold[car].account);
+    if (carCold[car].plate[0] || carCold[car].account[0]) printf("\n");
+    if (carHot[car].slot >= 1) {
+        char buf[32];
+        format_time(slotEntryTime(carHot[car].slot), buf, sizeof(buf));
+        printf("Car %d parked at Slot %d (entry %s)\n", car, carHot[car].slot, buf);
+    } else if (carHot[car].slot == -3) {
+        char buf[32];
+        int s = carHot[car].offer;
+        format_time(slotEntryTime(s) + holdSecs, buf, sizeof(buf));
+        printf("Car %d has Slot %d held until %s\n", car, s, buf);
+    } else if (carHot[car].slot == -2) {
+        printf("Car %d is in the waiting queue.\n", car);
+    } else {
+        printf("Car %d not found.\n", car);
+    }
+}
+
+void showParkedVehicles() {
+    Snapshot *sn = snapshotAcquire();
+    if (!sn) return;
+    printf("\nParked Cars \n");
+    int any = 0;
+    for (int s = 1; s <= sn->numSlots; s++) {
+        uint32_t c = sn->slots[s].car;
+        if (c != SLOT_FREE && !(c & SLOT_F_HELD)) {
+            char buf[32];
+            format_time(slotEpoch + sn->slots[s].entryRel, buf, sizeof(buf));
+            printf("Slot %d: Car %u (entry %s)\n", s, c & SLOT_CAR_MASK, buf);
+            any = 1;
+        }
+    }
+    if (!any) printf("None\n");
+    snapshotRelease();
+}
+
+void showWaitingQueue() {
+    Snapshot *sn = snapshotAcquire();
+    if (!sn) return;
+    for (int z = 0; z < sn->numZones; z++) {
+        int count = sn->waitCount[z];
+        if (sn->numZones == 1) printf("\nWaiting Queue (%d/%d) \n", count, WAIT_CAP);
+        else printf("\nZone %d Waiting Queue (%d/%d) \n", z, count, WAIT_CAP);
+        if (count == 0) { printf("Empty\n"); continue; }
+        for (int i = 0; i < count; i++) printf("%d. Car %d\n", i+1, sn->waiting[z * WAIT_CAP + i]);
+    }
+    if (holdSecs > 0) {
+        printf("\nOffers\n");
+        int any = 0;
+        for (int s = 1; s <= sn->numSlots; s++) {
+            uint32_t c = sn->slots[s].car;
+            if (c == SLOT_FREE || !(c & SLOT_F_HELD)) continue;
+            char buf[32];
+            format_time(slotEpoch + sn->slots[s].entryRel + holdSecs, buf, sizeof(buf));
+            printf("Slot %d held for Car %u until %s\n", s, c & SLOT_CAR_MASK, buf);
+            any = 1;
+        }
+        if (!any) printf("None\n");
+    }
+    snapshotRelease();
+}
+
+void showRevenue() {
+    printf("\nTotal Revenue: Rs %d\n", totalRevenue);
+}
+
+void emergencyAt(time_t now) {
+    /* stays cut short still wore their slots; open offers just end */
+    for (int s = 1; s <= numSlots; s++) {
+        if (slotHeld(s)) {
+            timerCancel(holdTimer[s]);
+            holdTimer[s] = 0;
+        } else if (slotState[s].car != SLOT_FREE) {
+            slotUseAdd(s, (long)(now - slotEntryTime(s)));
+            slotFreed[s] = (int32_t)(now - slotEpoch);
+        }
+    }
+    for (int c = 0; c < numCars; c++) {
+        CarHot *h = &carHot[c];
+        /* close the stays in the history too, or they stay open forever */
+        if (h->session) {
+            h->session->exitTime = now;
+            __atomic_store_n(&h->session->exitSeq, atomic_load(&eventSeq) + 1, __ATOMIC_RELEASE);
+            carCold[c].lastStay = h->session;
+        }
+        h->slot = -1;
+        h->entryRel = 0;
+        h->session = NULL;
+        h->flags &= ~CAR_F_OVERSTAY;
+        h->stayPos = -1;
+        h->offer = 0;
+    }
+    stayWatch.size = stayFlagged.size = 0;
+    for (int z = 0; z < numZones; z++) zoneReset(&zones[z]);
+    occRecord(now);
+    journalEvent(JR_EMERGENCY, -1, -1, 0, now);
+    traceSimple(TR_EMERGENCY, -1, now);
+    gateCommit();
+    if (checkMode) checkFull("emergency", -1);
+    /* keep totalRevenue and the history records */
+}
+
+void emergencyMode() {
+    printf("\n!!! EMERGENCY MODE ACTIVE !!!\nSystem cleared. History retained.\n");
+    emergencyAt(clockNow());
+}
+
+/* returns 0 for an invalid car id */
+int passAt(int car, time_t now) {
+    int ok = car >= 0 && car < numCars;
+    if (ok) {
+        carHot[car].flags |= CAR_F_PASS;
+        carCold[car].passSince = now;
+        journalEvent(JR_PASS, car, -1, 0, now);
+        gateCommit();
+    }
+    traceSimple(TR_PASS, car, now);
+    return ok;
+}
+
+int policyByName(const char *name) {
+    for (int p = 0; p < ALLOC_POLICIES; p++) if (strcmp(name, allocPolicyName[p]) == 0) return p;
+    return -1;
+}
+
+/* switches zone z, or every zone if z is -1; 0 for a bad zone or policy,
+   or if a zone's store could not be allocated */
+int policyAt(int z, int policy, time_t now) {
+    if (policy < 0 || policy >= ALLOC_POLICIES || z < -1 || z >= numZones) return 0;
+    int ok = 1;
+    for (int k = z < 0 ? 0 : z; k <= (z < 0 ? numZones - 1 : z); k++) {
+        if (!zoneSetPolicy(&zones[k], policy)) { ok = 0; continue; }
+        journalEvent(JR_POLICY, k, policy, 0, now);
+        tracePolicy(k, policy, now);
+    }
+    gateCommit();
+    if (checkMode) checkFull("policy switch", -1);
+    return ok;
+}
+
+void showPolicies() {
+    printf("\nAllocation policy per zone:\n");
+    for (int z = 0; z < numZones; z++)
+        printf("  zone %d, slots %d-%d: %s, %d free\n", z, zones[z].first, zones[z].last,
+               allocPolicyName[zones[z].policy], zoneFreeCount(&zones[z]));
+}
+
+void choosePolicy() {
+    showPolicies();
+    int z, p;
+    if (!read_int("Zone (-1 for all): ", &z)) return;
+    for (p = 0; p < ALLOC_POLICIES; p++) printf("%d %s\n", p, allocPolicyName[p]);
+    if (!read_int("Policy: ", &p)) return;
+    if (!policyAt(z, p, clockNow())) printf("Invalid.\n");
+    else showPolicies();
+}
+
+void addMonthlyPass(int car) {
+    if (!passAt(car, clockNow())) { printf("Invalid.\n"); return; }
+    printf("Car %d registered as Monthly Pass.\n", car);
+}
+
+/* ----- Gate logic ----- */
+/* gateEntry / gateExit hold the state transitions and never print, so
+   they can be driven by the menu, benchmarks or anything else; the
+   vehicle* wrappers handle input and messages. */
+enum {
+    GATE_PARKED,        /* car got a slot */
+    GATE_QUEUED,        /* lot full, car joined the waiting queue */
+    GATE_FULL,          /* lot and waiting queue full */
+    GATE_INVALID,       /* car id out of range */
+    GATE_DUP_PARKED,    /* entry for a car already parked */
+    GATE_DUP_WAITING,   /* entry for a car already waiting */
+    GATE_EXITED,        /* car left its slot */
+    GATE_UNQUEUED,      /* waiting car left the queue */
+    GATE_NOT_PARKED,    /* exit for a car that is not here */
+    GATE_ACCEPTED,      /* offered car took its held slot */
+    GATE_EXPIRED,       /* offer lapsed, the slot moved on */
+    GATE_STALE,         /* resent request the dedup window cannot answer */
+    GATE_AMENDED        /* late event corrected a stay already recorded */
+};
+
+typedef struct {
+    int status;         /* GATE_* */
+    int slot;
+    time_t entry;
+    time_t exit;        /* also the time of a declined or lapsed offer */
+    int fee;
+    int position;       /* queue position after GATE_QUEUED */
+    int nextCar;        /* waiting car handed the freed slot, -1 if none */
+    int nextSlot;
+} GateResult;
+
+int canEnter(int car) {
+    if (car < 0 || car >= numCars) return GATE_INVALID;
+    if (carHot[car].slot >= 1) return GATE_DUP_PARKED;
+    if (carHot[car].slot == -2) return GATE_DUP_WAITING;
+    return GATE_PARKED;
+}
+
+void parkCar(int car, int slot, time_t now) {
+    CarHot *h = &carHot[car];
+    h->slot = slot;
+    h->entryRel = (int32_t)(now - slotEpoch);
+    h->flags &= ~CAR_F_OVERSTAY;
+    stayInsert(&stayWatch, car);
+    slotOccupy(slot, car, now);
+    PROF_BEGIN(tHist);
+    h->session = addHistoryNode(car, slot, now, 0);
+    PROF_END(tHist, PH_HISTORY);
+}
+
+/* --hold: slot waits for car until now + holdSecs */
+void holdOffer(int car, int slot, time_t now) {
+    CarHot *h = &carHot[car];
+    h->slot = -3;
+    h->offer = slot;
+    slotHold(slot, car, now);
+    holdTimer[slot] = timerAdd(now + holdSecs, holdFire, slot);
+    journalEvent(JR_OFFER, car, slot, 0, now);
+}
+
+/* the waiting car a slot freed in zn goes to: this zone's queue first,
+   otherwise the longest one. Takes the slot; -1 if nobody waits. */
+static int queueNext(Zone *zn, int *slot) {
+    WaitQueue *wq = &zn->wait;
+    if (wq->count == 0)
+        for (int z = 0; z < numZones; z++) if (zones[z].wait.count > wq->count) wq = &zones[z].wait;
+    int next = -1;
+    *slot = -1;
+    if (wq->count > 0) {
+        next = dequeueWait(wq);
+        if (next >= 0 && next < numCars) {
+            *slot = zoneTake(zn);
+            if (*slot == -1) enqueueWait(wq, next);
+        }
+    }
+    return *slot != -1 ? next : -1;
+}
+
+/* parks next in slot, or with --hold offers it */
+static void handOff(int next, int slot, time_t now, GateResult *r) {
+    if (holdSecs > 0) holdOffer(next, slot, now);
+    else {
+        parkCar(next, slot, now);
+        journalEvent(JR_ENTRY, next, slot, 0, now);
+    }
+    r->nextCar = next;
+    r->nextSlot = slot;
+}
+
+/* ends car's offer and passes the held slot on */
+static void holdDrop(int car, time_t now, GateResult *r) {
+    CarHot *h = &carHot[car];
+    int slot = h->offer;
+    timerCancel(holdTimer[slot]);
+    holdTimer[slot] = 0;
+    h->slot = -1;
+    h->offer = 0;
+    r->slot = slot;
+    r->exit = now;
+    Zone *zn = zoneOfSlot(slot);
+    slotRelease(slot);
+    zoneGive(zn, slot);
+    int ns, next = queueNext(zn, &ns);
+    if (next != -1) handOff(next, ns, now, r);
+    occRecord(now);
+}
+
+int feeFor(const CarHot *h, long secs) {
+    int charged_hours = (secs + 3599) / 3600; /* ceil to next hour */
+    if (charged_hours < 0) charged_hours = 0;
+    return (h->flags & CAR_F_PASS) ? 0 : charged_hours * FEE_PER_HOUR;
+}
+
+void gateEntryCore(int car, time_t now, GateResult *r) {
+    PROF_EVENT();
+    r->nextCar = -1;
+    PROF_BEGIN(tVal);
+    r->status = canEnter(car);
+    PROF_END(tVal, PH_VALIDATE);
+    if (r->status != GATE_PARKED) return;
+    if (carHot[car].slot == -3) {
+        /* the offered car is here: its held slot becomes a stay */
+        int slot = carHot[car].offer;
+        timerCancel(holdTimer[slot]);
+        holdTimer[slot] = 0;
+        carHot[car].offer = 0;
+        parkCar(car, slot, now);
+        r->status = GATE_ACCEPTED;
+        r->slot = slot;
+        r->entry = now;
+        journalEvent(JR_ENTRY, car, slot, 0, now);
+        gateCommit();
+        return;
+    }
+    int slot = -1, home = (int)(homeZone(car) - zones);
+    PROF_BEGIN(tAlloc);
+    for (int k = 0; k < numZones && slot == -1; k++) slot = zoneTake(&zones[(home + k) % numZones]);
+    PROF_END(tAlloc, PH_ALLOC);
+    if (slot == -1) {
+        int z = home;
+        while (!enqueueWait(&zones[z].wait, car)) {
+            z = (z + 1) % numZones;
+            if (z == home) { r->status = GATE_FULL; return; }
+        }
+        WaitQueue *w = &zones[z].wait;
+        carHot[car].slot = -2;
+        carHot[car].waitZone = z;
+        r->status = GATE_QUEUED;
+        r->position = w->count;
+        journalEvent(JR_QUEUED, car, -1, 0, now);
+        gateCommit();
+        return;
+    }
+    parkCar(car, slot, now);
+    occRecord(now);
+    r->slot = slot;
+    r->entry = now;
+    journalEvent(JR_ENTRY, car, slot, 0, now);
+    gateCommit();
+}
+
+void gateExitCore(int car, time_t now, GateResult *r) {
+    PROF_EVENT();
+    r->nextCar = -1;
+    PROF_BEGIN(tVal);
+    int bad = car < 0 || car >= numCars || carHot[car].slot == -1;
+    PROF_END(tVal, PH_VALIDATE);
+    if (bad) { r->status = car < 0 || car >= numCars ? GATE_INVALID : GATE_NOT_PARKED; return; }
+    CarHot *h = &carHot[car];
+    if (h->slot == -3) {
+        journalEvent(JR_UNQUEUED, car, h->offer, 0, now);
+        holdDrop(car, now, r);
+        r->status = GATE_UNQUEUED;
+        gateCommit();
+        return;
+    }
+    if (h->slot == -2) {
+        /* remove from waiting queue by rebuilding queue */
+        int tmp[WAIT_CAP];
+        int idx = 0;
+        int removed = 0;
+        WaitQueue *wq = &zones[h->waitZone].wait;
+        int origCount = wq->count;
+        for (int i = 0; i < origCount; i++) {
+            int w = dequeueWait(wq);
+            if (w == car) { removed = 1; carHot[w].slot = -1; }
+            else tmp[idx++] = w;
+        }
+        for (int i = 0; i < idx; i++) enqueueWait(wq, tmp[i]);
+        r->status = removed ? GATE_UNQUEUED : GATE_NOT_PARKED;
+        r->slot = -1;
+        if (removed) {
+            journalEvent(JR_UNQUEUED, car, -1, 0, now);
+            gateCommit();
+        }
+        return;
+    }
+    int slot = h->slot;
+    /* the overstay heap node and its parent are the exit's coldest reads */
+    const StayHeap *sh = stayHeapOf(car);
+    __builtin_prefetch(&sh->key[h->stayPos], 1);
+    __builtin_prefetch(&sh->key[(h->stayPos - 1) / HEAP_ARITY]);
+    time_t entry = slotEpoch + h->entryRel;
+    double diff = difftime(now, entry);
+    if (diff < 0) diff = 0;
+    r->status = GATE_EXITED;
+    r->slot = slot;
+    r->entry = entry;
+    r->exit = now;
+    PROF_BEGIN(tFee);
+    r->fee = feeFor(h, (long) diff);
+    totalRevenue += r->fee;
+    dwellRecord(slot, h->flags & CAR_F_PASS, entry, (long) diff);
+    slotUseAdd(slot, (long) diff);
+    slotFreed[slot] = (int32_t)(now - slotEpoch);
+    PROF_END(tFee, PH_FEE);
+    journalEvent(JR_EXIT, car, slot, r->fee, now);
+    PROF_BEGIN(tHist);
+    if (h->session) {
+        h->session->fee = r->fee;
+        h->session->exitTime = now;
+        /* visible to snapshots taken after this event's gateCommit */
+        __atomic_store_n(&h->session->exitSeq, atomic_load(&eventSeq) + 1, __ATOMIC_RELEASE);
+        carCold[car].lastStay = h->session;
+    }
+    PROF_END(tHist, PH_HISTORY);
+    PROF_BEGIN(tAlloc);
+    /* free slot */
+    stayRemove(stayHeapOf(car), car);
+    h->flags &= ~CAR_F_OVERSTAY;
+    h->slot = -1;
+    h->entryRel = 0;
+    h->session = NULL;
+    Zone *zn = zoneOfSlot(slot);
+    slotRelease(slot);
+    zoneGive(zn, slot);
+    /* straight to the next waiting car, if any */
+    int newSlot, next = queueNext(zn, &newSlot);
+    PROF_END(tAlloc, PH_ALLOC);
+    if (next != -1) handOff(next, newSlot, now, r);
+    occRecord(now);
+    gateCommit();
+}
+
+int checkEvent(int car, const GateResult *r, char *err, size_t errsz) {
+    int bad = 0;
+    if (car < 0 || car >= numCars) return 0;
+    switch (r->status) {
+        case GATE_PARKED:
+            bad += checkParked(car, r->slot, err, errsz);
+            if (!bad) {
+                Zone *zn = zoneOfSlot(r->slot);
+                for (Zone *z = homeZone(car); z != zn; z = z - zones + 1 < numZones ? z + 1 : zones)
+                    CHECK(zoneFreeCount(z) == 0, "car %d parked in zone %d while zone %d has free slots", car,
+                          (int)(zn - zones), (int)(z - zones));
+                if (zn->policy == ALLOC_LOWEST)
+                    CHECK(zn->heap.size == 0 || zn->heap.arr[HEAP_ARITY - 1] > r->slot,
+                          "slot %d handed out but still at the top of the heap", r->slot);
+                else if (zn->policy == ALLOC_ROUND_ROBIN)
+                    CHECK(zn->cursor == r->slot - zn->first + 1, "slot %d handed out but the cursor is at %d",
+                          r->slot, zn->cursor);
+                else if (zn->policy == ALLOC_LEAST_USED)
+                    CHECK(zn->keyed.size == 0 || zn->keyed.arr[HEAP_ARITY - 1] > freeKey(zn, r->slot),
+                          "slot %d handed out but a less used one is still free", r->slot);
+                bad += checkHeapPaths(zn, -1, bad ? NULL : err, bad ? 0 : errsz);
+            }
+            break;
+        case GATE_QUEUED:
+        case GATE_FULL:
+            for (int z = 0; z < numZones; z++) CHECK(zoneFreeCount(&zones[z]) == 0, "car %d turned away while zone %d has free slots", car, z);
+            CHECK(carHot[car].slot == (r->status == GATE_QUEUED ? -2 : -1), "car %d marked %d after entry", car, carHot[car].slot);
+            if (r->status == GATE_QUEUED) bad += checkQueue(&zones[carHot[car].waitZone], bad ? NULL : err, bad ? 0 : errsz);
+            else
+                for (int z = 0; z < numZones; z++)
+                    CHECK(zones[z].wait.count == WAIT_CAP, "car %d turned away while zone %d's queue has room", car, z);
+            break;
+        case GATE_ACCEPTED:
+            bad += checkParked(car, r->slot, err, errsz);
+            CHECK(holdTimer[r->slot] == 0, "slot %d taken but its offer still runs", r->slot);
+            break;
+        case GATE_UNQUEUED:
+        case GATE_EXPIRED:
+            CHECK(carHot[car].slot == -1 && carHot[car].offer == 0, "car %d marked %d after leaving the queue", car, carHot[car].slot);
+            bad += checkQueue(&zones[carHot[car].waitZone], bad ? NULL : err, bad ? 0 : errsz);
+            if (r->slot < 1) break;
+            /* a declined or lapsed offer: the slot went on or came free */
+            if (r->nextCar != -1) bad += checkHeld(r->nextCar, r->nextSlot, bad ? NULL : err, bad ? 0 : errsz);
+            else {
+                CHECK(slotState[r->slot].car == SLOT_FREE, "slot %d not released after its offer ended", r->slot);
+                bad += checkHeapPaths(zoneOfSlot(r->slot), r->slot, bad ? NULL : err, bad ? 0 : errsz);
+            }
+            break;
+        case GATE_EXITED: {
+            CHECK(carHot[car].slot == -1 && !carHot[car].session, "car %d still marked %d after exit", car, carHot[car].slot);
+            CHECK(carHot[car].stayPos == -1, "car %d left in an overstay heap after exit", car);
+            CHECK(r->fee >= 0, "car %d charged %d", car, r->fee);
+            Zone *zn = zoneOfSlot(r->slot);
+            if (r->nextCar != -1) {
+                /* somebody was waiting, so the lot was full: the freed slot is the only free one */
+                CHECK(r->nextSlot == r->slot, "waiting car %d got slot %d, not the freed %d", r->nextCar, r->nextSlot, r->slot);
+                if (holdSecs > 0) bad += checkHeld(r->nextCar, r->nextSlot, bad ? NULL : err, bad ? 0 : errsz);
+                else bad += checkParked(r->nextCar, r->nextSlot, bad ? NULL : err, bad ? 0 : errsz);
+                bad += checkQueue(&zones[carHot[r->nextCar].waitZone], bad ? NULL : err, bad ? 0 : errsz);
+            } else {
+                CHECK(slotState[r->slot].car == SLOT_FREE, "slot %d not released", r->slot);
+                bad += checkHeapPaths(zn, r->slot, bad ? NULL : err, bad ? 0 : errsz);
+            }
+            break;
+        }
+        default:
+            /* rejected: the car's own record must still be coherent */
+            if (carHot[car].slot >= 1) bad += checkParked(car, carHot[car].slot, err, errsz);
+            break;
+    }
+    return bad;
+}
+
+/* checkQuickPolicy: the allocation order of the non-lowest policies,
+   out of line so the common case stays small */
+int checkQuickPolicy(const Zone *zn, int s) {
+    if (zn->policy == ALLOC_ROUND_ROBIN) return zn->cursor == s - zn->first + 1;
+    if (zn->policy == ALLOC_LEAST_USED) return !zn->keyed.size || zn->keyed.arr[HEAP_ARITY - 1] > freeKey(zn, s);
+    return 1;
+}
+
+/* A plain entry or exit as one predicate over lines the event already
+   loaded: the car's, its slot's entry and the zone's next free slot.
+   Run inline after every one; 0 sends it to checkEvent, which says what
+   is wrong. The car was validated by the gate (the status says so). */
+static inline int checkQuickEntry(int car, const GateResult *r) {
+    if (r->status != GATE_PARKED) return 0;
+    int s = r->slot;
+    const CarHot *h = &carHot[car];
+    const SlotState *st = &slotState[s];
+    const Zone *zn = numZones == 1 ? zones : zoneOfSlot(s);
+    int ok = (h->slot == s) & ((int)(st->car & SLOT_CAR_MASK) == car) & (st->entryRel == h->entryRel);
+    /* a lowest-first heap's top is HEAP_EMPTY when it is empty */
+    return zn->policy == ALLOC_LOWEST ? ok & (zn->heap.arr[HEAP_ARITY - 1] > s) : ok && checkQuickPolicy(zn, s);
+}
+
+static inline int checkQuickExit(int car, const GateResult *r) {
+    if (r->status != GATE_EXITED || r->nextCar != -1) return 0;
+    int s = r->slot;
+    const CarHot *h = &carHot[car];
+    const Zone *zn = numZones == 1 ? zones : zoneOfSlot(s);
+    return (h->slot == -1) & !h->session & (slotState[s].car == SLOT_FREE) & (r->fee >= 0) &
+           (zn->policy != ALLOC_LOWEST || zn->heap.arr[HEAP_ARITY - 1] <= s);
+}
+
+#define CHECK_DEEP 256      /* plain entries/exits per extra checkEvent (heap paths, overstay heap) */
+long checkEvents = 0;
+
+/* 1 when --check incremental is satisfied by the quick test */
+#define CHECK_QUICK(test) (checkMode == CHECK_INCREMENTAL && (test) && ++checkEvents % CHECK_DEEP)
+
+/* after a gate event when --check is on and the quick test did not settle it */
+void checkAfter(const char *what, int car, const GateResult *r) {
+    if (checkMode == CHECK_FULL) { checkFull(what, car); return; }
+    char err[160];
+    err[0] = '\0';
+    checkReport(what, car, checkEvent(car, r, err, sizeof(err)), err);
+}
+
+/* the trace form of an entry/exit outcome; fields the status does not
+   set are normalised so replays compare equal */
+void traceOutcome(TraceRec *rec, int op, int car, time_t now, const GateResult *r) {
+    int took = r->status == GATE_PARKED || r->status == GATE_EXITED || r->status == GATE_ACCEPTED ||
+               r->status == GATE_EXPIRED || r->status == GATE_AMENDED;
+    *rec = (TraceRec){ (uint8_t) op, (uint8_t) r->status,
+                       (uint16_t)(r->status == GATE_QUEUED ? r->position : 0), car, (int64_t) now, 0,
+                       took ? r->slot : -1, r->status == GATE_EXITED || r->status == GATE_AMENDED ? r->fee : 0,
+                       r->nextCar, r->nextCar != -1 ? r->nextSlot : -1 };
+}
+
+/* a lapsed offer: the slot's car loses it and the next waiting car gets
+   it; returns that car, -1 if the slot was not held */
+int gateExpireCore(int slot, time_t now, GateResult *r) {
+    r->nextCar = -1;
+    if (!holdTimer || slot < 1 || slot > numSlots || !slotHeld(slot)) { r->status = GATE_NOT_PARKED; r->slot = -1; return -1; }
+    int car = slotCar(slot);
+    r->status = GATE_EXPIRED;
+    journalEvent(JR_EXPIRED, car, slot, 0, now);
+    holdDrop(car, now, r);
+    gateCommit();
+    return car;
+}
+
+/* With placement on, an event runs on the worker of the zone whose
+   tables it touches: an entry on the car's home zone (where it looks
+   for a slot first), an exit on the zone of the car's slot or queue,
+   an expiry on the slot's zone. */
+typedef struct {
+    int op, arg;
+    time_t now;
+    GateResult *r;
+    int ret;
+} GateJob;
+
+static void gateJobRun(Zone *zn, void *p) {
+    GateJob *j = p;
+    (void)zn;
+    if (j->op == TR_ENTRY) gateEntryCore(j->arg, j->now, j->r);
+    else if (j->op == TR_EXIT) gateExitCore(j->arg, j->now, j->r);
+    else j->ret = gateExpireCore(j->arg, j->now, j->r);
+}
+
+static Zone *gateZone(int op, int arg) {
+    if (!pinZones) return NULL;
+    if (op == TR_EXPIRE) return arg >= 1 && arg <= numSlots ? zoneOfSlot(arg) : NULL;
+    if (arg < 0 || arg >= numCars) return NULL;
+    const CarHot *h = &carHot[arg];
+    if (op == TR_ENTRY || h->slot == -1) return homeZone(arg);
+    if (h->slot == -2) return &zones[h->waitZone];
+    return zoneOfSlot(h->slot == -3 ? h->offer : h->slot);
+}
+
+static int gateRun(int op, int arg, time_t now, GateResult *r) {
+    GateJob j = { op, arg, now, r, -1 };
+    Zone *zn = gateZone(op, arg);
+    if (zn) zoneCall(zn, gateJobRun, &j);
+    else gateJobRun(NULL, &j);
+    return j.ret;
+}
+
+void gateEntry(int car, time_t now, GateResult *r) {
+    gateRun(TR_ENTRY, car, now, r);
+    if (traceOn) {
+        TraceRec rec;
+        traceOutcome(&rec, TR_ENTRY, car, now, r);
+        traceInput(&rec);
+    }
+    if (checkMode && !CHECK_QUICK(checkQuickEntry(car, r))) checkAfter("entry", car, r);
+}
+
+void gateExit(int car, time_t now, GateResult *r) {
+    gateRun(TR_EXIT, car, now, r);
+    if (traceOn) {
+        TraceRec rec;
+        traceOutcome(&rec, TR_EXIT, car, now, r);
+        traceInput(&rec);
+    }
+    if (checkMode && !CHECK_QUICK(checkQuickExit(car, r))) checkAfter("exit", car, r);
+}
+
+int gateExpire(int slot, time_t now, GateResult *r) {
+    int car = gateRun(TR_EXPIRE, slot, now, r);
+    if (traceOn) {
+        TraceRec rec;
+        traceOutcome(&rec, TR_EXPIRE, car, now, r);
+        traceInput(&rec);
+    }
+    if (checkMode) checkAfter("expire", car, r);
+    return car;
+}
+
+/* car's newest closed stay, NULL if the history ring holds none */
+Node *lastStay(int car) {
+    return carCold[car].lastStay;
+}
+
+/* brackets a change to a stay snapshot readers may already see; End
+   republishes it with exitSeq seq (0 for a stay still open) */
+static inline void histRewriteBegin(Node *n) {
+    __atomic_store_n(&n->exitSeq, HIST_WRITING, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void histRewriteEnd(Node *n, uint64_t seq) {
+    __atomic_store_n(&n->exitSeq, seq, __ATOMIC_RELEASE);
+}
+
+/* Re-bills closed stay n as entry..exit; returns the revenue change.
+   If n is the slot's newest stay, a moved exit moves slotFreed with it,
+   and the open stay that followed it, if any, gets the new slotFree. */
+static int stayRefee(Node *n, time_t entry, time_t exit) {
+    const CarHot *h = &carHot[n->car];
+    long was = (long) difftime(n->exitTime, n->entryTime), now = (long) difftime(exit, entry);
+    int delta = feeFor(h, now) - feeFor(h, was);
+    int32_t oldEnd = (int32_t)(n->exitTime - slotEpoch), newEnd = (int32_t)(exit - slotEpoch);
+    totalRevenue += delta;
+    histRewriteBegin(n);
+    if (newEnd != oldEnd && slotFreed[n->slot] == oldEnd) {
+        slotFreed[n->slot] = newEnd;
+        uint32_t occ = slotState[n->slot].car;
+        Node *next = occ != SLOT_FREE && !(occ & SLOT_F_HELD) ? carHot[occ & SLOT_CAR_MASK].session : NULL;
+        if (next && next->slotFree == oldEnd) {
+            histRewriteBegin(next);
+            next->slotFree = newEnd;
+            histRewriteEnd(next, 0);
+        }
+    }
+    n->fee += delta;
+    SlotUse *u = &slotUse[n->slot];
+    if (u->busySecs != UINT32_MAX) {
+        int64_t b = (int64_t) u->busySecs + (now > 0 ? now : 0) - (was > 0 ? was : 0);
+        u->busySecs = b < 0 ? 0 : b < UINT32_MAX ? (uint32_t) b : UINT32_MAX;
+    }
+    n->entryTime = entry;
+    n->exitTime = exit;
+    /* the corrected stay, as of this event's gateCommit */
+    histRewriteEnd(n, atomic_load(&eventSeq) + 1);
+    return delta;
+}
+
+/* A late entry or exit (TR_ENTRY / TR_EXIT at time t, older than events
+   already applied) corrects the stay it belongs to rather than running:
+   an entry before the parked car's recorded one, or before its last
+   closed stay, moves that stay's start back; an exit inside its last
+   closed stay ends it at t. A moved start is clamped to the end of the
+   slot's previous stay, so the slot is never booked twice. Closed stays
+   are re-billed and the change goes to revenue (r->fee). Slot
+   assignments already made stand, so an exit for a car still parked is
+   the caller's to run first. */
+void gateAmendCore(int op, int car, time_t t, GateResult *r) {
+    r->nextCar = -1;
+    r->slot = -1;
+    r->fee = 0;
+    if (car < 0 || car >= numCars || (op != TR_ENTRY && op != TR_EXIT)) { r->status = GATE_INVALID; return; }
+    CarHot *h = &carHot[car];
+    Node *n = lastStay(car);
+    r->status = GATE_NOT_PARKED;
+    if (op == TR_ENTRY && h->slot >= 1) {
+        if (t >= slotEpoch + h->entryRel) { r->status = GATE_DUP_PARKED; return; }
+        if ((n && t < n->exitTime) || (int64_t) t - slotEpoch < INT32_MIN) return;
+        int32_t prev = slotFreed[h->slot];
+        if (prev != INT32_MIN && t < slotEpoch + prev) t = slotEpoch + prev;
+        if (t >= slotEpoch + h->entryRel) return;
+        StayHeap *sh = stayHeapOf(car);
+        stayRemove(sh, car);
+        h->entryRel = (int32_t)(t - slotEpoch);
+        slotState[h->slot].entryRel = h->entryRel;
+        stayInsert(sh, car);
+        if (h->session) {
+            histRewriteBegin(h->session);
+            h->session->entryTime = t;
+            histRewriteEnd(h->session, 0);
+        }
+        r->slot = h->slot;
+        r->entry = t;
+        r->exit = 0;
+    } else {
+        if (!n || t >= n->exitTime || (op == TR_EXIT && t < n->entryTime) || (op == TR_ENTRY && t >= n->entryTime))
+            return;
+        if (op == TR_ENTRY && n->slotFree != INT32_MIN && t < slotEpoch + n->slotFree) {
+            t = slotEpoch + n->slotFree;
+            if (t >= n->entryTime) return;
+        }
+        r->slot = n->slot;
+        r->fee = op == TR_ENTRY ? stayRefee(n, t, n->exitTime) : stayRefee(n, n->entryTime, t);
+        r->entry = n->entryTime;
+        r->exit = n->exitTime;
+    }
+    r->status = GATE_AMENDED;
+    journalEvent(JR_AMEND, car, r->slot, r->fee, t);
+    gateCommit();
+}
+
+void gateAmend(int op, int car, time_t t, GateResult *r) {
+    gateAmendCore(op, car, t, r);
+    if (traceOn) {
+        TraceRec rec;
+        traceOutcome(&rec, TR_AMEND, car, t, r);
+        rec.position = (uint16_t) op;
+        traceInput(&rec);
+    }
+    if (checkMode) checkAfter("amend", car, r);
+}
+
+/* where the freed slot went */
+void printHandOff(const GateResult *r) {
+    if (r->nextCar == -1) return;
+    char buf[32];
+    if (holdSecs > 0) {
+        format_time(r->exit + holdSecs, buf, sizeof(buf));
+        printf("Offered Slot %d to waiting Car %d until %s\n", r->nextSlot, r->nextCar, buf);
+    } else {
+        format_time(r->exit, buf, sizeof(buf));
+        printf("Allocated Slot %d to waiting Car %d (Entry: %s)\n", r->nextSlot, r->nextCar, buf);
+    }
+}
+
+void printEntry(int car, const GateResult *rp) {
+    GateResult r = *rp;
+    switch (r.status) {
+        case GATE_INVALID: printf("Invalid.\n"); return;
+        case GATE_DUP_PARKED: printf("Duplicate: Car %d already parked.\n", car); return;
+        case GATE_DUP_WAITING: printf("Duplicate: Car %d already in waiting.\n", car); return;
+        case GATE_FULL: printf("Parking & Waiting FULL!\n"); return;
+        case GATE_QUEUED:
+            printf("Parking full: Car %d added to waiting at position %d.\n", car, r.position);
+            return;
+    }
+    char buf[32];
+    format_time(r.entry, buf, sizeof(buf));
+    printf("Car %d parked at Slot %d (Entry: %s)\n", car, r.slot, buf);
+}
+
+void printExit(int car, const GateResult *rp) {
+    GateResult r = *rp;
+    switch (r.status) {
+        case GATE_INVALID: printf("Invalid car id.\n"); return;
+        case GATE_NOT_PARKED:
+            if (carHot[car].slot == -2) printf("Car %d not found in waiting queue.\n", car);
+            else printf("Car %d not parked.\n", car);
+            return;
+        case GATE_UNQUEUED:
+            if (r.slot < 1) printf("Car %d removed from waiting queue.\n", car);
+            else printf("Car %d declined Slot %d.\n", car, r.slot);
+            printHandOff(&r);
+            return;
+    }
+    long secs = (long) difftime(r.exit, r.entry);
+    if (secs < 0) secs = 0;
+    char bufEntry[32], bufExit[32];
+    format_time(r.entry, bufEntry, sizeof(bufEntry));
+    format_time(r.exit, bufExit, sizeof(bufExit));
+    printf("Car %d exited from Slot %d\n", car, r.slot);
+    printf("Entry : %s\n", bufEntry);
+    printf("Exit  : %s\n", bufExit);
+    printf("Duration: %ld hr %ld min %ld sec\n", secs / 3600, (secs % 3600) / 60, secs % 60);
+    printf("Fee: Rs %d\n", r.fee);
+    printHandOff(&r);
+}
+
+/* one gate event plus its message, shared by the menu and batch mode */
+void entryAt(int car, time_t now) {
+    GateResult r;
+    gateEntry(car, now, &r);
+    PROF_BEGIN(tOut);
+    printEntry(car, &r);
+    PROF_END(tOut, PH_OUTPUT);
+}
+
+void exitAt(int car, time_t now) {
+    GateResult r;
+    gateExit(car, now, &r);
+    PROF_BEGIN(tOut);
+    printExit(car, &r);
+    PROF_END(tOut, PH_OUTPUT);
+}
+
+/* the wheel's callback for a lapsed offer */
+void expireAt(int32_t slot, time_t now) {
+    GateResult r;
+    int car = gateExpire(slot, now, &r);
+    if (car < 0) return;
+    printf("Offer of Slot %d to Car %d lapsed\n", slot, car);
+    printHandOff(&r);
+}
+
+/* a late event's correction and its message */
+int amendAt(int op, int car, time_t t) {
+    GateResult r;
+    gateAmend(op, car, t, &r);
+    char buf[32];
+    /* a corrected entry may have been clamped to the slot's previous stay */
+    format_time(r.status != GATE_AMENDED ? t : op == TR_ENTRY ? r.entry : r.exit, buf, sizeof(buf));
+    const char *what = op == TR_ENTRY ? "entry" : "exit";
+    if (r.status == GATE_INVALID) printf("Invalid car id.\n");
+    else if (r.status != GATE_AMENDED) printf("Late %s of Car %d at %s: nothing to correct.\n", what, car, buf);
+    else if (r.exit == 0) printf("Car %d's entry corrected to %s\n", car, buf);
+    else printf("Car %d's %s corrected to %s, fee adjusted by Rs %d\n", car, what, buf, r.fee);
+    return r.status == GATE_AMENDED;
+}
+
+void vehicleEntry() {
+    int car;
+    char prompt[48];
+    snprintf(prompt, sizeof(prompt), "Enter car id (0..%d): ", numCars - 1);
+    if (!read_int(prompt, &car)) { printf("Invalid input.\n"); return; }
+    entryAt(car, clockNow());
+}
+
+void vehicleExit() {
+    int car;
+    if (!read_int("Enter car id to exit: ", &car)) { printf("Invalid input.\n"); return; }
+    exitAt(car, clockNow());
+}
+
+/* Moves cars past --overstay from stayWatch to stayFlagged, announcing
+   each once, and with --overstay-close checks the flagged ones out as
+   ordinary exits (fee, journal, trace). Runs from the sweep timer. */
+int overstayCheck(time_t now) {
+    if (overstayLimit <= 0) return 0;
+    int n = 0;
+    while (stayWatch.size > 0) {
+        int car = (int)(uint32_t) stayWatch.key[0];
+        long stayed = (long)(now - slotEpoch) - carHot[car].entryRel;
+        if (stayed < overstayLimit) break;
+        stayRemove(&stayWatch, car);
+        carHot[car].flags |= CAR_F_OVERSTAY;
+        stayInsert(&stayFlagged, car);
+        n++;
+        printf("Overstay: car %d in slot %d for %.1f h\n", car, carHot[car].slot, stayed / 3600.0);
+    }
+    while (overstayClose && stayFlagged.size > 0) {
+        int car = (int)(uint32_t) stayFlagged.key[0];
+        GateResult r;
+        gateExit(car, now, &r);
+        if (r.status != GATE_EXITED) break;
+        printf("Overstay: car %d checked out of slot %d, fee Rs %d\n", car, r.slot, r.fee);
+        if (r.nextCar != -1) printf("Allocated Slot %d to waiting Car %d\n", r.nextSlot, r.nextCar);
+    }
+    return n;
+}
+
+/* One timer tracks the oldest watched car's deadline. Entries only add
+   later deadlines and exits can only push it back, so re-arming after
+   each command is enough; a sweep that finds nothing due re-arms on the
+   new oldest car. */
+void overstaySweep(int32_t arg, time_t now);
+
+void overstayArm() {
+    if (overstayLimit <= 0) return;
+    time_t due = stayWatch.size ? slotEpoch + carHot[(uint32_t) stayWatch.key[0]].entryRel + overstayLimit : 0;
+    if (overstayTimer && due == overstayDue) return;
+    timerCancel(overstayTimer);
+    overstayTimer = due ? timerAdd(due, overstaySweep, 0) : 0;
+    overstayDue = due;
+}
+
+void overstaySweep(int32_t arg, time_t now) {
+    (void) arg;
+    overstayTimer = 0;
+    overstayCheck(now);
+    overstayArm();
+}
+
+/* after every command: arm for what it changed, fire what is due */
+void timersTick() {
+    overstayArm();
+    timerRun(clockNow());
+}
+
+void timerReport() {
+    time_t next = timerNextDue();
+    printf("Timers: %ld pending, pool %d", timersPending, timerCap);
+    if (next) {
+        char buf[32];
+        format_time(next, buf, sizeof(buf));
+        printf(", next due %s", buf);
+    }
+    printf("\n");
+}
+
+#define OVERSTAY_ROWS 50
+
+/* cars parked at least hours, oldest first, from both heaps */
+void overstayReport(double hours) {
+    time_t now = clockNow();
+    int parked = stayWatch.size + stayFlagged.size;
+    uint64_t *found = malloc((parked > 0 ? parked : 1) * sizeof(uint64_t));
+    if (!found) { printf("Out of memory.\n"); return; }
+    int64_t dueRel = (int64_t)(now - slotEpoch) - (int64_t)(hours * 3600);
+    if (dueRel < INT32_MIN) dueRel = INT32_MIN;
+    if (dueRel > INT32_MAX) dueRel = INT32_MAX;
+    uint32_t due = (uint32_t)(int32_t) dueRel ^ 0x80000000u;
+    int n = stayCollect(&stayFlagged, 0, due, found, 0);
+    n = stayCollect(&stayWatch, 0, due, found, n);
+    qsort(found, n, sizeof(uint64_t), cmpU64);
+    printf("\nOverstays of %.1f h or more: %d of %d parked cars (%d flagged past --overstay)\n",
+           hours, n, parked, stayFlagged.size);
+    if (n) printf("  %-8s %-7s %-20s %8s %9s\n", "car", "slot", "entered", "hours", "fee due");
+    for (int i = 0; i < n && i < OVERSTAY_ROWS; i++) {
+        int car = (int)(uint32_t) found[i];
+        const CarHot *h = &carHot[car];
+        time_t entry = slotEpoch + h->entryRel;
+        char buf[32];
+        format_time(entry, buf, sizeof(buf));
+        printf("  %-8d %-7d %-20s %8.1f %9d%s\n", car, h->slot, buf, (now - entry) / 3600.0,
+               feeFor(h, (long)(now - entry)), h->flags & CAR_F_OVERSTAY ? "  flagged" : "");
+    }
+    if (n > OVERSTAY_ROWS) printf("  ... %d more\n", n - OVERSTAY_ROWS);
+    free(found);
+}
+
+void showOverstays() {
+    double hours = overstayLimit > 0 ? overstayLimit / 3600.0 : 24;
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "Parked at least how many hours (%.0f)? ", hours);
+    int h;
+    if (read_int(prompt, &h) && h >= 0) hours = h;
+    overstayReport(hours);
+}
+
+void showHistory() {
+    Snapshot *sn = snapshotAcquire();
+    if (!sn) return;
+    printf("\nParking History (most recent first)\n");
+    if (!sn->history) printf("None\n");
+    Node rec;
+    for (Node *t = sn->history; snapHistRead(sn, t, &rec); t = rec.next) {
+        char be[32], bx[32];
+        time_t exitT = snapExitTime(sn, &rec);
+        format_time(rec.entryTime, be, sizeof(be));
+        if (exitT == 0) {
+            printf("Car %d -> Slot %d | %s -> STILL PARKED\n", rec.car, rec.slot, be);
+        } else {
+            format_time(exitT, bx, sizeof(bx));
+            printf("Car %d -> Slot %d | %s -> %s\n", rec.car, rec.slot, be, bx);
+        }
+    }
+    snapshotRelease();
+}
+
+void showFreeSlots() {
+    Snapshot *sn = snapshotAcquire();
+    int *list = sn ? malloc(sn->numSlots * sizeof(int)) : NULL;
+    if (!list) { if (sn) snapshotRelease(); return; }
+    int n = freeScan(sn->slots, 1, sn->numSlots, list);
+    snapshotRelease();
+    printf("Free Slots: ");
+    for (int i = 0; i < n; i++) printf("%d ", list[i]);
+    if (!n) printf("None");
+    printf("\n");
+    free(list);
+}
+
+/* history as CSV (most recent first), written through a LogWriter */
+void exportHistoryTo(const char *path) {
+    LogWriter *w = logOpen(path, 1);
+    if (!w) { printf("Cannot open %s.\n", path); return; }
+    Snapshot *sn = snapshotAcquire();
+    long rows = 0;
+    logAppend(w, "car,slot,entry,exit\n", 20);
+    Node rec;
+    for (Node *t = sn ? sn->history : NULL; snapHistRead(sn, t, &rec); t = rec.next) {
+        char line[96], be[32], bx[32] = "";
+        time_t exitT = snapExitTime(sn, &rec);
+        format_time(rec.entryTime, be, sizeof(be));
+        if (exitT) format_time(exitT, bx, sizeof(bx));
+        int n = snprintf(line, sizeof(line), "%d,%d,%s,%s\n", rec.car, rec.slot, be, bx);
+        logAppend(w, line, n);
+        rows++;
+    }
+    if (sn) snapshotRelease();
+    const char *backend = logBackendName(w);
+    if (logClose(w)) printf("Exported %ld records to %s (%s).\n", rows, path, backend);
+    else printf("Export to %s failed.\n", path);
+}
+
+void exportHistory() {
+    char path[256];
+    if (!read_str("Export file: ", path, sizeof(path))) { printf("Invalid input.\n"); return; }
+    exportHistoryTo(path);
+}
+
+/* ----- Request dedup (gate, seq) ----- */
+/* Gate controllers number their requests and resend when a reply is
+   lost, so one entry or exit can arrive more than once. gateRequest runs
+   each (gate, seq) once and keeps its outcome in the gate's ring of its
+   last DEDUP_WINDOW requests; one open-addressing table over all the
+   rings finds a resend in O(1), and the resend gets the first outcome
+   back without touching the lot. A request leaving a ring leaves the
+   table too, so memory is fixed at startup. A resend older than its
+   gate's window, or a seq reused for another car or direction, cannot
+   be answered truthfully and gets GATE_STALE. */
+#define DEDUP_WINDOW 64
+#define DEDUP_EMPTY 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t seq;
+    int32_t op;             /* TR_ENTRY or TR_EXIT */
+    int32_t car;
+    GateResult res;
+} DedupEntry;
+
+typedef struct {
+    DedupEntry ring[DEDUP_WINDOW];
+    int head, count;        /* oldest entry, entries in use */
+    int64_t floor;          /* highest seq pushed out, -1 if none */
+} DedupGate;
+
+int numGates = 16;              /* --gates */
+DedupGate *dedupGates;
+uint32_t *dedupTable;           /* gate * DEDUP_WINDOW + ring index, DEDUP_EMPTY if free */
+uint32_t dedupMask;
+long dedupHits, dedupStale;
+
+void dedupReset() {
+    for (int g = 0; g < numGates; g++) {
+        dedupGates[g].head = dedupGates[g].count = 0;
+        dedupGates[g].floor = -1;
+    }
+    memset(dedupTable, 0xFF, ((size_t) dedupMask + 1) * sizeof(uint32_t));
+    dedupHits = dedupStale = 0;
+}
+
+/* the table stays at most half full */
+int dedupAlloc() {
+    uint32_t cap = 1;
+    while (cap < 2u * (uint32_t) numGates * DEDUP_WINDOW) cap <<= 1;
+    dedupGates = malloc(numGates * sizeof(DedupGate));
+    dedupTable = malloc(cap * sizeof(uint32_t));
+    dedupMask = cap - 1;
+    if (!dedupGates || !dedupTable) return 0;
+    dedupReset();
+    return 1;
+}
+
+static inline uint32_t dedupHash(int gate, uint32_t seq) {
+    return (uint32_t)(((uint64_t)(uint32_t) gate << 32 | seq) * 0x9e3779b97f4a7c15ull >> 32) & dedupMask;
+}
+
+static inline DedupEntry *dedupAt(uint32_t v) {
+    return &dedupGates[v / DEDUP_WINDOW].ring[v % DEDUP_WINDOW];
+}
+
+/* table cell holding (gate, seq), or the free cell that ends its probe */
+static uint32_t dedupFind(int gate, uint32_t seq) {
+    uint32_t i = dedupHash(gate, seq);
+    while (dedupTable[i] != DEDUP_EMPTY &&
+           ((int)(dedupTable[i] / DEDUP_WINDOW) != gate || dedupAt(dedupTable[i])->seq != seq))
+        i = (i + 1) & dedupMask;
+    return i;
+}
+
+/* empties cell i, pulling later cells of its probe run back over the hole */
+static void dedupErase(uint32_t i) {
+    uint32_t j = i;
+    dedupTable[i] = DEDUP_EMPTY;
+    for (;;) {
+        j = (j + 1) & dedupMask;
+        uint32_t v = dedupTable[j];
+        if (v == DEDUP_EMPTY) return;
+        uint32_t k = dedupHash((int)(v / DEDUP_WINDOW), dedupAt(v)->seq);
+        /* stays put if its home lies cyclically in (i, j] */
+        if (i <= j ? i < k && k <= j : i < k || k <= j) continue;
+        dedupTable[i] = v;
+        dedupTable[j] = DEDUP_EMPTY;
+        i = j;
+    }
+}
+
+/* Runs entry or exit (TR_ENTRY / TR_EXIT) request seq from gate once.
+   1 if it ran; 0 if r is the stored outcome of an earlier copy, or a
+   refusal (GATE_INVALID, GATE_STALE). */
+int gateRequest(int gate, uint32_t seq, int op, int car, time_t now, GateResult *r) {
+    r->nextCar = -1;
+    r->slot = -1;
+    if (gate < 0 || gate >= numGates || (op != TR_ENTRY && op != TR_EXIT)) { r->status = GATE_INVALID; return 0; }
+    DedupGate *g = &dedupGates[gate];
+    uint32_t i = dedupFind(gate, seq);
+    if (dedupTable[i] != DEDUP_EMPTY) {
+        const DedupEntry *e = dedupAt(dedupTable[i]);
+        if (e->op == op && e->car == car) {
+            *r = e->res;
+            dedupHits++;
+            return 0;
+        }
+    }
+    if (dedupTable[i] != DEDUP_EMPTY || (int64_t) seq <= g->floor) {
+        r->status = GATE_STALE;
+        dedupStale++;
+        return 0;
+    }
+    if (op == TR_ENTRY) gateEntry(car, now, r);
+    else gateExit(car, now, r);
+    int k;
+    if (g->count < DEDUP_WINDOW) k = (g->head + g->count++) % DEDUP_WINDOW;
+    else {
+        k = g->head;
+        g->head = (g->head + 1) % DEDUP_WINDOW;
+        if ((int64_t) g->ring[k].seq > g->floor) g->floor = g->ring[k].seq;
+        dedupErase(dedupFind(gate, g->ring[k].seq));
+        i = dedupFind(gate, seq);   /* the erase may have moved the probe run */
+    }
+    g->ring[k] = (DedupEntry){ seq, op, car, *r };
+    dedupTable[i] = (uint32_t) gate * DEDUP_WINDOW + (uint32_t) k;
+    return 1;
+}
+
+/* 1 if gateRequest would answer (gate, seq) without running it */
+int dedupSeen(int gate, uint32_t seq) {
+    if (gate < 0 || gate >= numGates) return 1;
+    return dedupTable[dedupFind(gate, seq)] != DEDUP_EMPTY || (int64_t) seq <= dedupGates[gate].floor;
+}
+
+/* every ring entry reachable through the table and nothing else in it */
+int dedupCheck(char *err, size_t errsz) {
+    int bad = 0;
+    uint32_t used = 0, held = 0;
+    for (uint32_t i = 0; i <= dedupMask; i++) used += dedupTable[i] != DEDUP_EMPTY;
+    for (int gt = 0; gt < numGates; gt++) {
+        const DedupGate *g = &dedupGates[gt];
+        for (int n = 0; n < g->count; n++) {
+            int k = (g->head + n) % DEDUP_WINDOW;
+            uint32_t i = dedupFind(gt, g->ring[k].seq);
+            CHECK(dedupTable[i] == (uint32_t) gt * DEDUP_WINDOW + (uint32_t) k, "gate %d request %u lost from the dedup table",
+                  gt, g->ring[k].seq);
+            CHECK((int64_t) g->ring[k].seq > g->floor, "gate %d request %u kept below the window floor", gt, g->ring[k].seq);
+            held++;
+        }
+    }
+    CHECK(used == held, "dedup table holds %u requests, rings %u", used, held);
+    return bad;
+}
+
+/* a gate request plus its message; resends say so */
+void requestAt(int op, int car, int gate, uint32_t seq, time_t now) {
+    GateResult r;
+    if (gateRequest(gate, seq, op, car, now, &r)) {
+        if (op == TR_ENTRY) printEntry(car, &r);
+        else printExit(car, &r);
+        return;
+    }
+    if (r.status == GATE_INVALID) printf("Invalid gate %d.\n", gate);
+    else if (r.status == GATE_STALE) printf("Gate %d request %u is stale or reused for another car.\n", gate, seq);
+    else {
+        printf("Gate %d request %u resent: ", gate, seq);
+        if (op == TR_ENTRY) printEntry(car, &r);
+        else printExit(car, &r);
+    }
+}
+
+/* ----- Reorder buffer (--watermark SECONDS) ----- */
+/* Offline gate logs arrive late and interleaved across gates. A timed
+   event ("at T entry CAR" in batch mode) is held in a min-heap on
+   (time, arrival) until the watermark, the latest time seen less
+   --watermark seconds, passes it; it is then applied at its own time,
+   the virtual clock stepping there and running timers on the way. An
+   event older than the clock, i.e. behind something already applied,
+   goes down the correction path instead (lateAt). */
+typedef struct {
+    time_t t;
+    uint64_t order;     /* arrival, breaks ties */
+    int op;             /* TR_ENTRY or TR_EXIT */
+    int car;
+    int gate;           /* -1 if not a numbered request */
+    uint32_t seq;
+} ReorderEv;
+
+long reorderLag = 0;            /* --watermark */
+ReorderEv *reorderHeap = NULL;
+int reorderSize = 0, reorderCap = 0;
+uint64_t reorderArrived = 0;
+time_t reorderHigh = 0;         /* latest event time seen */
+long reorderLate = 0, reorderFixed = 0;
+
+static inline int reorderBefore(const ReorderEv *a, const ReorderEv *b) {
+    return a->t < b->t || (a->t == b->t && a->order < b->order);
+}
+
+static int reorderPush(const ReorderEv *e) {
+    if (reorderSize == reorderCap) {
+        int cap = reorderCap ? 2 * reorderCap : 1024;
+        ReorderEv *h = realloc(reorderHeap, (size_t) cap * sizeof(ReorderEv));
+        if (!h) return 0;
+        reorderHeap = h;
+        reorderCap = cap;
+    }
+    int k = reorderSize++;
+    while (k > 0 && reorderBefore(e, &reorderHeap[(k - 1) / 2])) {
+        reorderHeap[k] = reorderHeap[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    reorderHeap[k] = *e;
+    return 1;
+}
+
+static ReorderEv reorderPop() {
+    ReorderEv top = reorderHeap[0], last = reorderHeap[--reorderSize];
+    int k = 0;
+    for (;;) {
+        int c = 2 * k + 1;
+        if (c >= reorderSize) break;
+        if (c + 1 < reorderSize && reorderBefore(&reorderHeap[c + 1], &reorderHeap[c])) c++;
+        if (!reorderBefore(&reorderHeap[c], &last)) break;
+        reorderHeap[k] = reorderHeap[c];
+        k = c;
+    }
+    if (reorderSize > 0) reorderHeap[k] = last;
+    return top;
+}
+
+void reorderFree() {
+    free(reorderHeap);
+    reorderHeap = NULL;
+    reorderSize = reorderCap = 0;
+}
+
+/* A late entry for a car that is not here parks it now and dates the
+   stay back, unless its last closed stay already covers t; a late exit
+   for a car parked since before t checks it out now and bills the stay
+   to t; anything else only amends history. A queued or offered car's
+   late exit just takes it out of the queue. */
+void lateAt(int op, int car, int gate, uint32_t seq, time_t t, time_t now) {
+    reorderLate++;
+    if (gate >= 0 && dedupSeen(gate, seq)) { requestAt(op, car, gate, seq, now); return; }
+    if (car >= 0 && car < numCars) {
+        CarHot *h = &carHot[car];
+        if (op == TR_ENTRY && h->slot == -1) {
+            Node *n = lastStay(car);
+            if (!n || t >= n->exitTime) {
+                entryAt(car, now);
+                if (h->slot < 1) return;
+            }
+        } else if (op == TR_EXIT && (h->slot == -2 || h->slot == -3)) {
+            exitAt(car, now);
+            return;
+        } else if (op == TR_EXIT && h->slot >= 1 && slotEpoch + h->entryRel <= t) exitAt(car, now);
+    }
+    reorderFixed += amendAt(op, car, t);
+}
+
+/* applies every held event up to time upTo, in time order */
+void reorderRelease(time_t upTo) {
+    while (reorderSize > 0 && reorderHeap[0].t <= upTo) {
+        ReorderEv e = reorderPop();
+        overstayArm();
+        timerRun(e.t);
+        if (e.gate >= 0) requestAt(e.op, e.car, e.gate, e.seq, e.t);
+        else if (e.op == TR_ENTRY) entryAt(e.car, e.t);
+        else exitAt(e.car, e.t);
+    }
+}
+
+/* takes one timed event: held, or corrected if already overtaken;
+   0 if out of memory */
+int reorderAt(int op, int car, int gate, uint32_t seq, time_t t) {
+    if (t < clockNow()) { lateAt(op, car, gate, seq, t, clockNow()); return 1; }
+    ReorderEv e = { t, reorderArrived++, op, car, gate, seq };
+    if (!reorderPush(&e)) return 0;
+    if (t > reorderHigh) reorderHigh = t;
+    reorderRelease(reorderHigh - reorderLag);
+    return 1;
+}
+
+void reorderReport() {
+    char buf[32] = "-";
+    if (reorderSize > 0) format_time(reorderHeap[0].t, buf, sizeof(buf));
+    printf("Reorder buffer: %d held (oldest %s), watermark %ld s behind the latest event\n", reorderSize, buf, reorderLag);
+    printf("  %ld arrived late, %ld of them corrected history\n", reorderLate, reorderFixed);
+}
+
+/* ----- Batch mode (./ds --batch FILE) ----- */
+/* Runs menu commands from a file ("-" for stdin), one per line:
+     entry CAR [GATE SEQ] | exit CAR [GATE SEQ] | pass CAR | search CAR | emergency
+     history | slots | parked | queue | revenue | free | profile
+     check | export FILE | advance SECONDS | timers | reorder | eod [DAYS] | query TEXT
+     at T entry CAR [GATE SEQ] | at T exit CAR [GATE SEQ]
+   With GATE SEQ an entry or exit is a numbered gate request, and sending
+   the same one again gets the first outcome back instead of a second
+   event. "at T" times an event T seconds after the script's start and
+   sends it through the reorder buffer; "advance" and the end of the
+   script apply whatever it holds up to the new time. Blank lines and lines starting with # are skipped. The virtual clock
+   starts at the current time and only moves on "advance", so a
+   script's fees do not depend on how fast it runs; "advance" steps it
+   through each timer deadline on the way, so overstays fire at their
+   own time rather than at the end of the jump. */
+int runBatch(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) { fprintf(stderr, "Cannot open batch file %s\n", path); return 2; }
+    clockSet(time(NULL));
+    time_t start = clockNow();
+    char line[512];
+    int lineNo = 0, errors = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        char cmd[32], arg[256] = "";
+        int n = sscanf(line, "%31s %255s", cmd, arg);
+        if (n < 1 || cmd[0] == '#') continue;
+        if (strcmp(cmd, "at") == 0) {
+            long t;
+            char what[16];
+            int car, gate = -1;
+            unsigned seq = 0;
+            int k = sscanf(line, "%*s %ld %15s %d %d %u", &t, what, &car, &gate, &seq);
+            int op = k >= 3 && strcmp(what, "entry") == 0 ? TR_ENTRY : k >= 3 && strcmp(what, "exit") == 0 ? TR_EXIT : 0;
+            if (k == 4) gate = -1;
+            if (!op || t < 0) {
+                fprintf(stderr, "%s:%d: bad command: %s", path, lineNo, line);
+                errors++;
+            } else if (!reorderAt(op, car, k == 5 ? gate : -1, seq, start + t)) {
+                fprintf(stderr, "%s:%d: reorder buffer out of memory\n", path, lineNo);
+                errors++;
+            }
+            timersTick();
+            continue;
+        }
+        long v = 0;
+        int num = n == 2 && sscanf(arg, "%ld", &v) == 1 && v >= INT_MIN && v <= INT_MAX;
+        int gate;
+        unsigned seq;
+        int sent = sscanf(line, "%*s %*s %d %u", &gate, &seq) == 2;
+        if (strcmp(cmd, "entry") == 0 && num && sent) requestAt(TR_ENTRY, (int) v, gate, seq, clockNow());
+        else if (strcmp(cmd, "exit") == 0 && num && sent) requestAt(TR_EXIT, (int) v, gate, seq, clockNow());
+        else if (strcmp(cmd, "entry") == 0 && num) entryAt((int) v, clockNow());
+        else if (strcmp(cmd, "exit") == 0 && num) exitAt((int) v, clockNow());
+        else if (strcmp(cmd, "pass") == 0 && num) addMonthlyPass((int) v);
+        else if (strcmp(cmd, "search") == 0 && num) searchCar((int) v);
+        else if (strcmp(cmd, "advance") == 0 && num && v >= 0) {
+            time_t to = clockNow() + v;
+            reorderRelease(to);
+            overstayArm();
+            timerRun(to);
+        }
+        else if (strcmp(cmd, "export") == 0 && n == 2) exportHistoryTo(arg);
+        else if (strcmp(cmd, "emergency") == 0) emergencyMode();
+        else if (strcmp(cmd, "history") == 0) showHistory();
+        else if (strcmp(cmd, "slots") == 0) showSlotMap();
+        else if (strcmp(cmd, "parked") == 0) showParkedVehicles();
+        else if (strcmp(cmd, "queue") == 0) showWaitingQueue();
+        else if (strcmp(cmd, "revenue") == 0) showRevenue();
+        else if (strcmp(cmd, "free") == 0) showFreeSlots();
+        else if (strcmp(cmd, "profile") == 0) profDump();
+        else if (strcmp(cmd, "check") == 0) showInvariants();
+        else if (strcmp(cmd, "dwell") == 0) dwellReport();
+        else if (strcmp(cmd, "occupancy") == 0) occupancyReport();
+        else if (strcmp(cmd, "utilization") == 0) slotUseReport();
+        else if (strcmp(cmd, "timers") == 0) timerReport();
+        else if (strcmp(cmd, "reorder") == 0) reorderReport();
+        else if (strcmp(cmd, "eod") == 0) eodReport(n == 2 && num ? (int) v : 1);
+        else if (strcmp(cmd, "query") == 0) queryRun(line + strspn(line, " \t") + 5);
+        else if (strcmp(cmd, "overstay") == 0) {
+            double hours = overstayLimit > 0 ? overstayLimit / 3600.0 : 24;
+            if (n == 2) hours = atof(arg);
+            overstayReport(hours);
+        }
+        else if (strcmp(cmd, "policy") == 0 && n == 2) {
+            char name[32] = "";
+            sscanf(line, "%*s %*s %31s", name);
+            int z = -2;
+            if (strcmp(arg, "all") == 0) z = -1;
+            else if (num && v >= 0) z = (int) v;
+            if (!policyAt(z, policyByName(name), clockNow())) {
+                fprintf(stderr, "%s:%d: bad policy: %s", path, lineNo, line);
+                errors++;
+            }
+        }
+        else if (strcmp(cmd, "policy") == 0) showPolicies();
+        else if (strcmp(cmd, "occupancy-export") == 0 && n == 2) {
+            long step = 60, secs = 30 * 86400L;
+            sscanf(line, "%*s %*s %ld %ld", &step, &secs);
+            if (!occupancyExport(arg, step, secs)) printf("Cannot export occupancy to %s\n", arg);
+        }
+        else if (strcmp(cmd, "dwell-save") == 0 && n == 2) { if (!dwellSave(arg)) printf("Cannot write %s\n", arg); }
+        else if (strcmp(cmd, "dwell-load") == 0 && n == 2) { if (!dwellLoad(arg)) printf("Cannot merge %s\n", arg); }
+        else {
+            fprintf(stderr, "%s:%d: bad command: %s", path, lineNo, line);
+            errors++;
+        }
+        timersTick();
+    }
+    reorderRelease(reorderHigh);
+    timersTick();
+    reorderFree();
+    if (f != stdin) fclose(f);
+    return errors ? 1 : 0;
+}
+
+/* ----- Replay (./ds --replay FILE) ----- */
+/* Rebuilds the recorded lot, feeds the inputs back in sequence order on
+   the virtual clock and compares every outcome and checkpoint digest
+   with the recording. A checkpoint mismatch bounds the divergence to the
+   inputs since the previous checkpoint; record with --trace-check 1 to
+   pin it to a single input. */
+int cmpTraceSeq(const void *a, const void *b) {
+    uint64_t x = ((const TraceRec *)a)->seq, y = ((const TraceRec *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+int traceSame(const TraceRec *a, const TraceRec *b) {
+    return a->op == b->op && a->status == b->status && a->position == b->position &&
+           a->car == b->car && a->time == b->time && a->slot == b->slot && a->fee == b->fee &&
+           a->nextCar == b->nextCar && a->nextSlot == b->nextSlot;
+}
+
+void printTraceRec(const char *label, const TraceRec *t) {
+    static const char *opName[] = { "?", "entry", "exit", "pass", "emergency", "checkpoint", "policy", "expire", "amend" };
+    printf("  %-8s #%llu %s car %d at %lld: status %d, slot %d, fee %d, next car %d -> slot %d\n", label,
+           (unsigned long long) t->seq, opName[t->op <= TR_AMEND ? t->op : 0], t->car, (long long) t->time,
+           t->status, t->slot, t->fee, t->nextCar, t->nextSlot);
+}
+
+int runReplay(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) { fprintf(stderr, "Cannot open trace %s\n", path); return 2; }
+    TraceHeader hd;
+    memset(&hd, 0, sizeof(hd));
+    long hdLen = (long) offsetof(TraceHeader, policy);
+    if (fread(&hd, hdLen, 1, f) != 1) hd.magic[0] = '\0';
+    int v1 = memcmp(hd.magic, TRACE_MAGIC_V1, 8) == 0;
+    int v2 = memcmp(hd.magic, TRACE_MAGIC_V2, 8) == 0;
+    if (v2 || memcmp(hd.magic, TRACE_MAGIC, 8) == 0) {
+        long rest = (v2 ? (long) offsetof(TraceHeader, holdSecs) : (long) sizeof(hd)) - hdLen;
+        if (fread(hd.policy, rest, 1, f) != 1) hd.magic[0] = '\0';
+        hdLen += rest;
+    } else if (!v1) hd.magic[0] = '\0';
+    if (!hd.magic[0]) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(f);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = (ftell(f) - hdLen) / (long) sizeof(TraceRec);
+    fseek(f, hdLen, SEEK_SET);
+    TraceRec *recs = malloc((n > 0 ? n : 1) * sizeof(TraceRec));
+    if (!recs || fread(recs, sizeof(TraceRec), n, f) != (size_t) n) {
+        fprintf(stderr, "Cannot read trace %s\n", path);
+        free(recs);
+        fclose(f);
+        return 2;
+    }
+    fclose(f);
+    if (hd.numSlots < 1 || hd.numCars < 1 || hd.numZones < 1 || hd.numZones > MAX_ZONES) {
+        fprintf(stderr, "Bad trace header in %s\n", path);
+        free(recs);
+        return 2;
+    }
+    numSlots = hd.numSlots;
+    numCars = hd.numCars;
+    numZones = hd.numZones;
+    histWanted = hd.histCap;
+    holdSecs = hd.holdSecs > 0 ? hd.holdSecs : 0;
+    for (int z = 0; z < numZones; z++) allocPolicy[z] = hd.policy[z] < ALLOC_POLICIES ? hd.policy[z] : ALLOC_LOWEST;
+    if (!allocTables()) { fprintf(stderr, "Out of memory.\n"); free(recs); return 1; }
+    clockSet((time_t) hd.epoch);
+    initSystem();
+    qsort(recs, n, sizeof(TraceRec), cmpTraceSeq);
+    long inputs = 0, checks = 0;
+    uint64_t lastCheck = 0;
+    int diverged = 0;
+    for (long i = 0; i < n && !diverged; i++) {
+        TraceRec *t = &recs[i], got;
+        if (t->seq != (uint64_t) i) {
+            printf("Trace incomplete: input #%ld is missing\n", i);
+            diverged = 1;
+            break;
+        }
+        if (t->op == TR_CHECK && v1) continue;
+        if (t->op == TR_CHECK) {
+            uint64_t d = stateDigest();
+            checks++;
+            if (d != (uint64_t) t->time) {
+                printf("State diverged between input #%llu and #%llu: digest %016llx recorded, %016llx replayed\n",
+                       (unsigned long long) lastCheck, (unsigned long long) t->seq,
+                       (unsigned long long) t->time, (unsigned long long) d);
+                diverged = 1;
+            }
+            lastCheck = t->seq;
+            continue;
+        }
+        clockSet((time_t) t->time);
+        GateResult r;
+        inputs++;
+        switch (t->op) {
+            case TR_ENTRY: gateEntry(t->car, (time_t) t->time, &r); traceOutcome(&got, TR_ENTRY, t->car, (time_t) t->time, &r); break;
+            case TR_EXIT: gateExit(t->car, (time_t) t->time, &r); traceOutcome(&got, TR_EXIT, t->car, (time_t) t->time, &r); break;
+            case TR_PASS: passAt(t->car, (time_t) t->time); got = *t; break;
+            case TR_EMERGENCY: emergencyAt((time_t) t->time); got = *t; break;
+            case TR_POLICY: policyAt(t->car, t->slot, (time_t) t->time); got = *t; break;
+            case TR_EXPIRE: {
+                /* replay runs no timers: lapsed offers come from the trace */
+                int car = gateExpire(t->slot, (time_t) t->time, &r);
+                traceOutcome(&got, TR_EXPIRE, car, (time_t) t->time, &r);
+                break;
+            }
+            case TR_AMEND:
+                gateAmend(t->position, t->car, (time_t) t->time, &r);
+                traceOutcome(&got, TR_AMEND, t->car, (time_t) t->time, &r);
+                got.position = t->position;
+                break;
+            default: got = *t; got.op = 0; break;
+        }
+        got.seq = t->seq;
+        if (!traceSame(&got, t)) {
+            printf("First divergence at input #%llu\n", (unsigned long long) t->seq);
+            for (long k = i > 3 ? i - 3 : 0; k < i; k++) printTraceRec("before", &recs[k]);
+            printTraceRec("recorded", t);
+            printTraceRec("replayed", &got);
+            diverged = 1;
+        }
+    }
+    if (!diverged) printf("Replayed %ld inputs and %ld checkpoints from %s: identical\n", inputs, checks, path);
+    printf("  state digest %016llx, revenue Rs %d, %d of %d slots taken\n", (unsigned long long) stateDigest(),
+           totalRevenue, numSlots - countFreeSlots(), numSlots);
+    free(recs);
+    return diverged;
+}
+
+/* ----- Async gate handler (stackless coroutines) ----- */
+/* Each gate runs as a GateCo, a stackless coroutine in the protothread
+   style. Its locals live in the struct, and CO_AWAIT saves a resume point
+   and returns while a device (plate camera, payment terminal, barrier)
+   works. The device completes it later by putting it back on the ready
+   queue. A few worker threads run whatever is ready, so thousands of
+   in-flight gate transactions need no thread each. State changes go
+   through gateEntry/gateExit under coreLock. ./ds --gate-sim runs it
+   against mock devices and checks the books at the end. */
+enum { CO_WAIT, CO_DONE };
+enum { DEV_PLATE, DEV_PAYMENT, DEV_BARRIER, DEV_RETRY, DEV_COUNT };
+
+#define CO_BEGIN(co) switch ((co)->pc) { case 0:
+#define CO_AWAIT(co, dev)                                       \
+    do {                                                        \
+        (co)->pc = __LINE__;                                    \
+        deviceSubmit((co), (dev));                              \
+        return CO_WAIT;                                         \
+        case __LINE__:;                                         \
+    } while (0)
+#define CO_END(co) } (co)->pc = -1; return CO_DONE
+
+typedef struct GateCo {
+    int pc;                 /* resume point, 0 = start, -1 = done */
+    int gate, car;
+    int round;
+    int devOk;              /* outcome of the last device request */
+    time_t now;
+    int fee;
+    uint32_t seq;           /* next request number from this gate */
+    double txnStart;
+    GateResult res;
+    double due;             /* device completion time */
+    struct GateCo *next;    /* ready queue link */
+} GateCo;
+
+pthread_mutex_t coreLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* mock devices: latency range in ms and failure rate in percent */
+typedef struct {
+    const char *name;
+    int minMs, maxMs, failPct;
+} MockDevice;
+
+MockDevice mockDevices[DEV_COUNT] = {
+    { "plate camera", 5, 30, 2 },
+    { "payment terminal", 40, 250, 3 },
+    { "barrier", 10, 50, 0 },
+    { "retry backoff", 20, 80, 0 }
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t readyCond, deviceCond;
+    GateCo *readyHead, *readyTail;
+    GateCo **pending;       /* device requests, min-heap on due */
+    int nPending, capPending;
+    int active;             /* coroutines not yet done */
+    int stop;
+    uint64_t rng;
+    int rounds;
+    double timeScale;       /* simulated seconds per real second */
+    double start;
+    time_t base;
+    /* stats */
+    long txns, entries, exits, queued, peakInFlight;
+    long resent, resentBad;     /* under coreLock */
+    long long feesPaid;
+    double latSum, latMax;
+} GateSim;
+
+GateSim sim;
+
+time_t simNow() {
+    return sim.base + (time_t)((monoSeconds() - sim.start) * sim.timeScale);
+}
+
+/* caller holds sim.lock */
+void simReady(GateCo *co) {
+    co->next = NULL;
+    if (sim.readyTail) sim.readyTail->next = co;
+    else sim.readyHead = co;
+    sim.readyTail = co;
+    pthread_cond_signal(&sim.readyCond);
+}
+
+void deviceSubmit(GateCo *co, int dev) {
+    MockDevice *d = &mockDevices[dev];
+    pthread_mutex_lock(&sim.lock);
+    uint64_t r = xorshift64(&sim.rng);
+    double ms = d->minMs + (double)(r % 1000) / 1000.0 * (d->maxMs - d->minMs);
+    co->devOk = (int)((r >> 20) % 100) >= d->failPct;
+    co->due = monoSeconds() + ms / 1000.0;
+    if (sim.nPending == sim.capPending) {
+        int cap = sim.capPending ? sim.capPending * 2 : 1024;
+        GateCo **p = realloc(sim.pending, cap * sizeof(GateCo *));
+        if (!p) { pthread_mutex_unlock(&sim.lock); abort(); }
+        sim.pending = p;
+        sim.capPending = cap;
+    }
+    int k = sim.nPending++;
+    while (k > 0 && sim.pending[(k - 1) / 2]->due > co->due) {
+        sim.pending[k] = sim.pending[(k - 1) / 2];
+        k = (k - 1) / 2;
+    }
+    sim.pending[k] = co;
+    if (k == 0) pthread_cond_signal(&sim.deviceCond);
+    pthread_mutex_unlock(&sim.lock);
+}
+
+GateCo *devicePopLocked() {
+    GateCo *top = sim.pending[0];
+    GateCo *last = sim.pending[--sim.nPending];
+    int k = 0;
+    while (1) {
+        int c = 2 * k + 1;
+        if (c >= sim.nPending) break;
+        if (c + 1 < sim.nPending && sim.pending[c + 1]->due < sim.pending[c]->due) c++;
+        if (last->due <= sim.pending[c]->due) break;
+        sim.pending[k] = sim.pending[c];
+        k = c;
+    }
+    if (sim.nPending) sim.pending[k] = last;
+    return top;
+}
+
+/* completes device requests as they fall due */
+void *deviceThread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&sim.lock);
+    while (!sim.stop) {
+        if (sim.nPending == 0) { pthread_cond_wait(&sim.deviceCond, &sim.lock); continue; }
+        double wait = sim.pending[0]->due - monoSeconds();
+        if (wait > 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            double at = ts.tv_sec + ts.tv_nsec * 1e-9 + wait;
+            ts.tv_sec = (time_t)at;
+            ts.tv_nsec = (long)((at - (double)ts.tv_sec) * 1e9);
+            pthread_cond_timedwait(&sim.deviceCond, &sim.lock, &ts);
+            continue;
+        }
+        simReady(devicePopLocked());
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return NULL;
+}
+
+void simTxnDone(GateCo *co) {
+    double lat = monoSeconds() - co->txnStart;
+    pthread_mutex_lock(&sim.lock);
+    sim.txns++;
+    sim.latSum += lat;
+    if (lat > sim.latMax) sim.latMax = lat;
+    switch (co->res.status) {
+        case GATE_PARKED: sim.entries++; break;
+        case GATE_QUEUED: sim.queued++; break;
+        case GATE_EXITED: sim.exits++; sim.feesPaid += co->res.fee; break;
+    }
+    pthread_mutex_unlock(&sim.lock);
+}
+
+#define SIM_LOST_PCT 5      /* replies lost, so the gate sends again */
+
+/* one numbered request from the gate; caller holds coreLock */
+void simSend(GateCo *co, int op) {
+    uint32_t seq = co->seq++;
+    gateRequest(co->gate, seq, op, co->car, co->now, &co->res);
+    if ((seq * 2654435761u ^ (uint32_t) co->gate * 40503u) % 100 >= SIM_LOST_PCT) return;
+    GateResult again;
+    TraceRec a, b;
+    gateRequest(co->gate, seq, op, co->car, co->now, &again);
+    traceOutcome(&a, op, co->car, co->now, &co->res);
+    traceOutcome(&b, op, co->car, co->now, &again);
+    sim.resent++;
+    sim.resentBad += !traceSame(&a, &b);
+}
+
+/* fee the car would pay if it left at co->now; caller holds coreLock */
+int quoteFee(GateCo *co) {
+    CarHot *h = &carHot[co->car];
+    return h->slot >= 1 ? feeFor(h, (long)(co->now - slotEpoch - h->entryRel)) : 0;
+}
+
+/* one gate: park its car, let it stay a while, take it out again */
+int gateCoRun(GateCo *co) {
+    CO_BEGIN(co);
+    for (co->round = 0; co->round < sim.rounds; co->round++) {
+        /* entry: read the plate, allocate, open the barrier */
+        co->txnStart = monoSeconds();
+        do { CO_AWAIT(co, DEV_PLATE); } while (!co->devOk);
+        while (1) {
+            co->now = simNow();
+            pthread_mutex_lock(&coreLock);
+            simSend(co, TR_ENTRY);
+            pthread_mutex_unlock(&coreLock);
+            if (co->res.status != GATE_FULL) break;
+            CO_AWAIT(co, DEV_RETRY);
+        }
+        if (co->res.status == GATE_PARKED) CO_AWAIT(co, DEV_BARRIER);
+        simTxnDone(co);
+        CO_AWAIT(co, DEV_RETRY);    /* dwell */
+
+        /* exit: read the plate, take payment, release, open the barrier */
+        co->txnStart = monoSeconds();
+        do { CO_AWAIT(co, DEV_PLATE); } while (!co->devOk);
+        while (1) {
+            co->now = simNow();
+            pthread_mutex_lock(&coreLock);
+            co->fee = quoteFee(co);
+            pthread_mutex_unlock(&coreLock);
+            if (co->fee > 0) {
+                do { CO_AWAIT(co, DEV_PAYMENT); } while (!co->devOk);
+            }
+            /* a queued car may have been given a slot while paying */
+            pthread_mutex_lock(&coreLock);
+            int same = quoteFee(co) == co->fee;
+            if (same) simSend(co, TR_EXIT);
+            pthread_mutex_unlock(&coreLock);
+            if (same) break;
+        }
+        if (co->res.status == GATE_EXITED) CO_AWAIT(co, DEV_BARRIER);
+        simTxnDone(co);
+    }
+    CO_END(co);
+}
+
+void *gateWorker(void *arg) {
+    (void)arg;
     while (1) {
-        int l = 2 * i, r = l + 1, smallest = i;
-        if (l <= heapSize && heapArr[l] < heapArr[smallest]) smallest = l;
-        if (r <= heapSize && heapArr[r] < heapArr[smallest]) smallest = r;
-        if (smallest == i) break;
-        heapSwap(i, smallest);
-        i = smallest;
+        pthread_mutex_lock(&sim.lock);
+        while (!sim.readyHead && sim.active > 0) pthread_cond_wait(&sim.readyCond, &sim.lock);
+        if (sim.active == 0) { pthread_mutex_unlock(&sim.lock); break; }
+        GateCo *co = sim.readyHead;
+        sim.readyHead = co->next;
+        if (!sim.readyHead) sim.readyTail = NULL;
+        if (sim.nPending > sim.peakInFlight) sim.peakInFlight = sim.nPending;
+        pthread_mutex_unlock(&sim.lock);
+        if (gateCoRun(co) == CO_DONE) {
+            pthread_mutex_lock(&sim.lock);
+            if (--sim.active == 0) {
+                sim.stop = 1;
+                pthread_cond_broadcast(&sim.readyCond);
+                pthread_cond_signal(&sim.deviceCond);
+            }
+            pthread_mutex_unlock(&sim.lock);
+        }
+    }
+    return NULL;
+}
+
+/* Runs every gate through `rounds` entry/exit cycles against the mock
+   devices, then checks that the lot is empty and revenue matches the
+   fees the gates collected. Returns 0 when the books balance. */
+int runGateSim(int gates, int rounds, int threads) {
+    GateCo *cos = calloc(gates, sizeof(GateCo));
+    pthread_t *tid = calloc(threads, sizeof(pthread_t));
+    if (!cos || !tid) { free(cos); free(tid); return 1; }
+    memset(&sim, 0, sizeof(sim));
+    pthread_mutex_init(&sim.lock, NULL);
+    pthread_cond_init(&sim.readyCond, NULL);
+    pthread_cond_init(&sim.deviceCond, NULL);
+    sim.rng = 0x2545f4914f6cdd1dULL;
+    sim.rounds = rounds;
+    sim.timeScale = 3600;   /* one real second is an hour at the gate */
+    sim.start = monoSeconds();
+    sim.base = slotEpoch;
+    sim.active = gates;
+    for (int g = 0; g < gates; g++) {
+        cos[g].gate = g;
+        cos[g].car = g;
+        simReady(&cos[g]);
+    }
+    pthread_t dev;
+    pthread_create(&dev, NULL, deviceThread, NULL);
+    int started = 0;
+    for (int t = 0; t < threads; t++) started += pthread_create(&tid[started], NULL, gateWorker, NULL) == 0;
+    if (started == 0) gateWorker(NULL);
+    for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+    pthread_join(dev, NULL);
+    double elapsed = monoSeconds() - sim.start;
+
+    int stillParked = 0;
+    for (int c = 0; c < numCars; c++) stillParked += carHot[c].slot != -1;
+    int ok = stillParked == 0 && countFreeSlots() == numSlots && totalRevenue == sim.feesPaid && sim.resentBad == 0;
+    printf("Gate simulation: %d gates x %d rounds on %d worker thread%s, %d slots\n",
+           gates, rounds, threads, threads == 1 ? "" : "s", numSlots);
+    printf("  %ld transactions in %.2f s (%.0f/s), peak %ld device requests in flight\n",
+           sim.txns, elapsed, sim.txns / elapsed, sim.peakInFlight);
+    printf("  latency avg %.1f ms, max %.1f ms\n", sim.latSum * 1e3 / (sim.txns ? sim.txns : 1), sim.latMax * 1e3);
+    printf("  %ld parked, %ld queued, %ld exits, fees Rs %lld, revenue Rs %d\n",
+           sim.entries, sim.queued, sim.exits, sim.feesPaid, totalRevenue);
+    printf("  %ld requests sent twice, %ld answered differently the second time\n", sim.resent, sim.resentBad);
+    printf("  %s\n", ok ? "OK: lot empty, revenue matches fees collected" : "MISMATCH");
+    free(sim.pending);
+    free(cos);
+    free(tid);
+    return ok ? 0 : 1;
+}
+
+/* ----- Allocation check (./ds --alloc-check) ----- */
+/* Drives random gate traffic through every path (entry, queue join,
+   exit, queue handoff, leaving the queue, rejection), with reports
+   taken along the way, and counts heap allocations per kind of event
+   once the system is warm. Build with -DALLOC_CHECK to count malloc too;
+   otherwise only the table allocator is seen. */
+enum { AC_ENTRY, AC_QUEUED, AC_EXIT, AC_HANDOFF, AC_UNQUEUED, AC_REJECTED, AC_KINDS };
+
+const char *acName[AC_KINDS] = { "entry", "queue join", "exit", "queue handoff", "queue leave", "rejected" };
+
+/* alternates fill phases (any car arrives or leaves) with drain phases
+   (only cars present leave) so the lot is sometimes full, sometimes not */
+void allocCheckRun(int events, uint64_t *seed, time_t *now, long count[AC_KINDS], long allocs[AC_KINDS]) {
+    GateResult r;
+    int phase = 4 * (numSlots + numZones * WAIT_CAP);
+    for (int i = 0; i < events; i++) {
+        int car = (int)(xorshift64(seed) % (uint64_t) numCars);
+        if ((i / phase) % 2 && carHot[car].slot == -1) continue;
+        *now += 60;
+        long before = atomic_load_explicit(&allocCalls, memory_order_relaxed);
+        int kind;
+        if (carHot[car].slot == -1) {
+            gateEntry(car, *now, &r);
+            kind = r.status == GATE_PARKED ? AC_ENTRY : r.status == GATE_QUEUED ? AC_QUEUED : AC_REJECTED;
+        } else {
+            gateExit(car, *now, &r);
+            kind = r.status == GATE_UNQUEUED ? AC_UNQUEUED : r.nextCar != -1 ? AC_HANDOFF : AC_EXIT;
+        }
+        if (i % 1024 == 0) {
+            Snapshot *sn = snapshotAcquire();
+            if (sn) snapshotRelease();
+        }
+        if (journal && i % 64 == 0) logFlush(journal, 0);
+        count[kind]++;
+        allocs[kind] += atomic_load_explicit(&allocCalls, memory_order_relaxed) - before;
     }
-    return ret;
 }
 
-/* ----- Waiting queue (circular) ----- */
-int waitQ[WAIT_CAP];
-int waitFront = 0, waitRear = -1, waitCount = 0;
-
-int enqueueWait(int car) {
-    if (waitCount == WAIT_CAP) return 0;
-    waitRear = (waitRear + 1) % WAIT_CAP;
-    waitQ[waitRear] = car;
-    if (waitCount == 0) waitFront = waitRear;
-    waitCount++;
+int runAllocCheck() {
+    if (numCars <= numSlots + numZones * WAIT_CAP) {
+        fprintf(stderr, "--alloc-check needs more cars than slots plus queue places\n");
+        return 2;
+    }
+    uint64_t seed = 777;
+    time_t now = slotEpoch;
+    long count[AC_KINDS] = { 0 }, allocs[AC_KINDS] = { 0 };
+    /* warm-up: wraps the history ring once and fills the snapshot spares */
+    int warm = (int)(histCap + histCap / 2);
+    allocCheckRun(warm, &seed, &now, count, allocs);
+    memset(count, 0, sizeof(count));
+    memset(allocs, 0, sizeof(allocs));
+    int events = (int)(2 * histCap);
+    allocCheckRun(events, &seed, &now, count, allocs);
+    long total = 0;
+    printf("Allocation check, %d slots / %d cars, %d steps after %d warm-up, history ring %ld records\n",
+           numSlots, numCars, events, warm, histCap);
+#if !(defined(ALLOC_CHECK) && defined(__GLIBC__))
+    printf("  (malloc not hooked: build with -DALLOC_CHECK on glibc to count it)\n");
+#endif
+    for (int k = 0; k < AC_KINDS; k++) {
+        printf("  %-14s %8ld events, %ld allocations\n", acName[k], count[k], allocs[k]);
+        total += allocs[k];
+    }
+    printf("  %s\n", total ? "FAIL: the gate path allocated" : "OK: no heap allocations on the gate path");
+    return total ? 1 : 0;
+}
+
+/* ----- History wrap check (./ds --wrap-check) ----- */
+/* Keeps car 0 parked while more short stays than the history ring holds
+   go through the other slots, then checks it out. Its stay must survive
+   the wrap, and the fees a query sums over the ring plus those recycled
+   out of it must come to totalRevenue. */
+static int64_t wrapFees(const char *text) {
+    Query q;
+    char err[128];
+    QueryPart res = { NULL, 0 };
+    int64_t sum = -1;
+    Snapshot *sn = snapshotAcquire();
+    if (sn && queryCompile(text, &q, err, sizeof(err)) && queryExec(sn, &q, 1, &res)) sum = res.row[1];
+    if (sn) snapshotRelease();
+    free(res.row);
+    return sum;
+}
+
+int runWrapCheck() {
+    if (numSlots < 2 || numCars < 2) {
+        fprintf(stderr, "--wrap-check needs at least 2 slots and 2 cars\n");
+        return 2;
+    }
+    GateResult r;
+    time_t now = clockNow();
+    gateEntry(0, now, &r);
+    long stays = histCap + numSlots;
+    for (long i = 0; i < stays; i++) {
+        int car = 1 + (int)(i % (numCars - 1));
+        gateEntry(car, now, &r);
+        now += 60;
+        gateExit(car, now, &r);
+    }
+    gateExit(0, now, &r);
+    int fee = r.fee;
+    int64_t own = wrapFees("sum(fee) where car = 0"), all = wrapFees("sum(fee)");
+    char err[160];
+    err[0] = '\0';
+    int bad = checkAll(err, sizeof(err));
+    printf("History wrap check, %d slots, ring %ld records, %ld short stays around one long one\n",
+           numSlots, histCap, stays);
+    printf("  long stay Rs %d, Rs %lld of it in history\n", fee, (long long) own);
+    printf("  history Rs %lld + recycled Rs %lld, total revenue Rs %d\n", (long long) all,
+           (long long) histDropped, totalRevenue);
+    int ok = fee > 0 && own == fee && all + histDropped == totalRevenue && !bad;
+    if (bad) printf("  %s\n", err);
+    printf("  %s\n", ok ? "OK: history revenue matches total revenue" : "FAIL: history lost revenue");
+    return ok ? 0 : 1;
+}
+
+/* ----- Late correction check (./ds --reorder-check) ----- */
+/* The cases the reorder buffer hands to gateAmend once an event is
+   overtaken. A late entry must be clamped to the end of the slot's
+   previous stay, and that end must follow corrections to it: whether
+   the next car is still parked or has already left when the previous
+   stay's exit is moved back. */
+static int reorderCase(const char *what, time_t got, time_t want, char *err, size_t errsz) {
+    if (got == want || err[0]) return got != want;
+    snprintf(err, errsz, "%s: entry dated %+ld s from the corrected exit", what, (long) difftime(got, want));
     return 1;
 }
 
-int dequeueWait() {
-    if (waitCount == 0) return -1;
-    int c = waitQ[waitFront];
-    waitFront = (waitFront + 1) % WAIT_CAP;
-    waitCount--;
-    if (waitCount == 0) { waitFront = 0; waitRear = -1; }
-    return c;
+int runReorderCheck() {
+    /* four cars with the same home zone, so each can reuse the slot the last one freed */
+    int c[4] = { 0, numZones, 2 * numZones, 3 * numZones };
+    if (numCars <= c[3] || holdSecs > 0) {
+        fprintf(stderr, "--reorder-check needs more than 3 * zones cars and no --hold\n");
+        return 2;
+    }
+    GateResult r;
+    char err[160];
+    err[0] = '\0';
+    int bad = 0;
+    time_t t0 = clockNow();
+    /* the next car arrives after the correction */
+    gateEntry(c[0], t0 + 50, &r);
+    int slot = r.slot;
+    gateExit(c[0], t0 + 5000, &r);
+    gateAmend(TR_EXIT, c[0], t0 + 200, &r);
+    gateEntry(c[1], t0 + 5000, &r);
+    int same = r.slot == slot;
+    gateAmend(TR_ENTRY, c[1], t0 + 10, &r);
+    if (same) bad += reorderCase("next car parked after the correction", r.entry, t0 + 200, err, sizeof(err));
+    gateExit(c[1], t0 + 6000, &r);
+    /* the next car parks first, leaves, then both are corrected */
+    gateEntry(c[2], t0 + 6000, &r);
+    slot = r.slot;
+    gateExit(c[2], t0 + 9000, &r);
+    gateEntry(c[3], t0 + 9000, &r);
+    same &= r.slot == slot;
+    gateAmend(TR_EXIT, c[2], t0 + 7000, &r);
+    gateExit(c[3], t0 + 9500, &r);
+    gateAmend(TR_ENTRY, c[3], t0 + 6500, &r);
+    if (same) bad += reorderCase("next car parked before the correction", r.entry, t0 + 7000, err, sizeof(err));
+    if (!bad) bad = checkAll(err, sizeof(err));
+    printf("Late correction check, %d slots: late entries after a corrected exit on the same slot\n", numSlots);
+    if (!same) printf("  (--alloc did not reuse the freed slot; only the invariants were checked)\n");
+    if (bad) printf("  %s\n", err);
+    printf("  %s\n", bad ? "FAIL: a late entry was clamped to a stale exit" : "OK: late entries follow corrected exits");
+    return bad ? 1 : 0;
 }
 
-/* ----- Parking data structures ----- */
-int slotOfCar[MAX_CARS];        /* car -> slot (1..MAX_SLOTS), -1 not present, -2 waiting */
-time_t entryTimeOfCar[MAX_CARS];
-int passUser[MAX_CARS];         /* 1 if monthly pass */
+/* ----- Property testing (./ds --prop N, libFuzzer target) ----- */
+/* Random operation sequences run against both the real gate and a
+   deliberately naive model: flat arrays, linear scans, no heaps and no
+   ring buffers. Every outcome must match the model's prediction, and
+   each sequence ends with a full comparison plus checkAll. A failing
+   sequence is shrunk by dropping operations while it still fails and
+   printed as a --batch script. Build with
+     clang -g -O1 -fsanitize=fuzzer,address -DPARKING_FUZZ ds.c -o ds-fuzz
+   to get a libFuzzer target over the same driver instead of main. */
+enum { PO_ENTRY, PO_EXIT, PO_PASS, PO_EMERGENCY, PO_POLICY, PO_RESEND };
 
-int slotToCar[MAX_SLOTS + 1];   /* slot -> car, -1 if empty */
+typedef struct {
+    unsigned char op;   /* PO_* */
+    int car;            /* may be out of range on purpose; zone * ALLOC_POLICIES + policy for PO_POLICY;
+                           how many operations back for PO_RESEND */
+    int dt;             /* seconds since the previous operation */
+} PropOp;
 
-typedef struct Node {
-    int car;
-    int slot;
-    time_t entryTime;
-    time_t exitTime; /* 0 if still parked */
-    struct Node *next;
-} Node;
+#define PROP_MAX_OPS 2048
 
-Node *history = NULL;
-int totalRevenue = 0;
+typedef struct {
+    int *slot;          /* per car: slot, -1 away, -2 waiting, -3 offered */
+    time_t *entry;
+    unsigned char *pass;
+    int *offer;         /* per car: slot offered to it, 0 if none */
+    time_t *offerAt;
+    uint64_t *offerSeq; /* order offers were made, for equal deadlines */
+    uint64_t offers;
+    int sent[DEDUP_WINDOW];     /* the gate's window: operation indexes, oldest first */
+    int nSent, sentFloor;
+    int *owner;         /* per slot: car or -1 */
+    uint64_t *busy;     /* per slot: occupied seconds */
+    uint64_t *freed;    /* per slot: release order, for lru */
+    uint64_t tick;
+    int policy[MAX_ZONES];
+    int cursor[MAX_ZONES];  /* round-robin: offset after the last slot taken */
+    int queue[MAX_ZONES][WAIT_CAP];
+    int queued[MAX_ZONES];
+    long revenue;
+} PropModel;
 
-/* ----- Utilities ----- */
-void addHistoryNode(int car, int slot, time_t entry, time_t exitT) {
-    Node *n = malloc(sizeof(Node));
-    if (!n) return;
-    n->car = car; n->slot = slot; n->entryTime = entry; n->exitTime = exitT;
-    n->next = history;
-    history = n;
+PropModel model;
+
+int propModelAlloc() {
+    model.slot = malloc(numCars * sizeof(int));
+    model.entry = malloc(numCars * sizeof(time_t));
+    model.pass = malloc(numCars);
+    model.owner = malloc((numSlots + 1) * sizeof(int));
+    model.busy = malloc((numSlots + 1) * sizeof(uint64_t));
+    model.freed = malloc((numSlots + 1) * sizeof(uint64_t));
+    model.offer = malloc(numCars * sizeof(int));
+    model.offerAt = malloc(numCars * sizeof(time_t));
+    model.offerSeq = malloc(numCars * sizeof(uint64_t));
+    return model.slot && model.entry && model.pass && model.owner && model.busy && model.freed && model.offer &&
+           model.offerAt && model.offerSeq;
 }
 
-void format_time(time_t t, char *buf, size_t bufsz) {
-    struct tm tmst;
-    localtime_r(&t, &tmst);
-    strftime(buf, bufsz, "%Y-%m-%d %H:%M:%S", &tmst);
+/* lapsed offers during a run, without the message */
+void propLapse(int32_t slot, time_t now) {
+    GateResult r;
+    gateExpire(slot, now, &r);
 }
 
-/* safer input helpers */
-int read_int(const char *prompt, int *out) {
-    char line[128];
-    if (prompt) {
-        printf("%s", prompt);
-        fflush(stdout);
+/* both sides back to an empty lot with no passes and no revenue */
+void propReset() {
+    for (int c = 0; c < numCars; c++) {
+        carHot[c] = (CarHot){ NULL, -1, 0, 0, -1, 0, 0 };
+        carCold[c].passSince = 0;
+        carCold[c].lastStay = NULL;
+        model.slot[c] = -1;
+        model.pass[c] = 0;
+        model.offer[c] = 0;
     }
-    if (!fgets(line, sizeof(line), stdin)) return 0;
-    char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
-    int tmp;
-    if (sscanf(line, "%d", &tmp) != 1) return 0;
-    *out = tmp;
-    return 1;
+    memset(slotUse, 0, (numSlots + 1) * sizeof(SlotUse));
+    for (int s = 0; s <= numSlots; s++) slotFreed[s] = INT32_MIN;
+    stayWatch.size = stayFlagged.size = 0;
+    timerReset(slotEpoch, 0);
+    if (holdTimer) memset(holdTimer, 0, (numSlots + 1) * sizeof(uint64_t));
+    holdFire = propLapse;
+    model.offers = 0;
+    dedupReset();
+    model.nSent = 0;
+    model.sentFloor = -1;
+    for (int z = 0; z < numZones; z++) {
+        zones[z].lap = 0;
+        zones[z].cursor = 0;
+        zoneReset(&zones[z]);
+        zoneSetPolicy(&zones[z], allocPolicy[z]);
+        model.policy[z] = zones[z].policy;
+        model.cursor[z] = 0;
+    }
+    totalRevenue = 0;
+    histReset();
+    for (int s = 0; s <= numSlots; s++) {
+        model.owner[s] = -1;
+        model.busy[s] = 0;
+        model.freed[s] = (uint64_t) s;
+    }
+    model.tick = (uint64_t) numSlots;
+    memset(model.queued, 0, sizeof(model.queued));
+    model.revenue = 0;
 }
 
-int read_char(const char *prompt, char *out) {
-    char line[32];
-    if (prompt) {
-        printf("%s", prompt);
-        fflush(stdout);
+/* the free slot zone z's policy hands out next, -1 if none: round-robin
+   scans from the cursor and wraps, the others from the first slot */
+int modelFreeSlot(int z) {
+    const Zone *zn = &zones[z];
+    int n = zn->last - zn->first + 1, p = model.policy[z], best = -1;
+    for (int i = 0; i < n; i++) {
+        int s = zn->first + (p == ALLOC_ROUND_ROBIN ? (model.cursor[z] + i) % n : i);
+        if (model.owner[s] != -1) continue;
+        if (p == ALLOC_LOWEST || p == ALLOC_ROUND_ROBIN) return s;
+        if (best == -1 || (p == ALLOC_LRU ? model.freed[s] < model.freed[best] : model.busy[s] < model.busy[best]))
+            best = s;
     }
-    if (!fgets(line, sizeof(line), stdin)) return 0;
-    *out = line[0];
-    return 1;
+    return best;
 }
 
-/* ----- System initialization & functions ----- */
-void initSystem() {
-    heapSize = 0;
-    for (int i = 1; i <= MAX_SLOTS; i++) heapInsert(i);
-    for (int i = 0; i < MAX_CARS; i++) {
-        slotOfCar[i] = -1;
-        entryTimeOfCar[i] = 0;
-        passUser[i] = 0;
-    }
-    for (int i = 0; i <= MAX_SLOTS; i++) slotToCar[i] = -1;
-    waitFront = 0; waitRear = -1; waitCount = 0;
-    totalRevenue = 0;
-    Node *t;
-    while (history) { t = history; history = history->next; free(t); }
+void modelPark(int car, int s, time_t now) {
+    int z = (s - 1) / zoneSpan;
+    if (model.policy[z] == ALLOC_ROUND_ROBIN) model.cursor[z] = s - zones[z].first + 1;
+    model.slot[car] = s;
+    model.owner[s] = car;
+    model.entry[car] = now;
 }
 
-void showSlotMap() {
-    printf("\n Slot Map \n");
-    for (int s = 1; s <= MAX_SLOTS; s++) {
-        if (slotToCar[s] == -1) printf("Slot %d: [Empty]\n", s);
-        else printf("Slot %d: [Car %d]\n", s, slotToCar[s]);
+/* --hold: taken from the free set like a park, but the car is not in */
+void modelOffer(int car, int s, time_t now) {
+    modelPark(car, s, now);
+    model.slot[car] = -3;
+    model.offer[car] = s;
+    model.offerAt[car] = now;
+    model.offerSeq[car] = ++model.offers;
+}
+
+/* slot s came free: the head of its zone's queue, else of the longest
+   (first on ties), gets it */
+void modelHandOff(int s, time_t now, GateResult *r) {
+    int z = (s - 1) / zoneSpan;
+    if (model.queued[z] == 0)
+        for (int k = 0; k < numZones; k++) if (model.queued[k] > model.queued[z]) z = k;
+    if (model.queued[z] == 0) return;
+    int next = model.queue[z][0];
+    memmove(&model.queue[z][0], &model.queue[z][1], --model.queued[z] * sizeof(int));
+    int ns = modelFreeSlot((s - 1) / zoneSpan);
+    if (holdSecs > 0) modelOffer(next, ns, now);
+    else modelPark(next, ns, now);
+    r->nextCar = next;
+    r->nextSlot = ns;
+}
+
+/* car's offer ends (declined or lapsed) and its slot moves on */
+void modelDrop(int car, time_t now, GateResult *r) {
+    int s = model.offer[car];
+    model.slot[car] = -1;
+    model.offer[car] = 0;
+    model.owner[s] = -1;
+    model.freed[s] = ++model.tick;
+    modelHandOff(s, now, r);
+}
+
+/* lapses every offer due by now, earliest deadline first, each at its
+   own deadline; a lapse can make a new offer that is due by now too */
+void modelExpire(time_t now) {
+    for (;;) {
+        int best = -1;
+        for (int c = 0; c < numCars; c++) {
+            if (model.slot[c] != -3 || model.offerAt[c] + holdSecs > now) continue;
+            if (best == -1 || model.offerAt[c] < model.offerAt[best] ||
+                (model.offerAt[c] == model.offerAt[best] && model.offerSeq[c] < model.offerSeq[best]))
+                best = c;
+        }
+        if (best == -1) return;
+        GateResult r;
+        modelDrop(best, model.offerAt[best] + holdSecs, &r);
     }
 }
 
-void searchCar(int car) {
-    if (car < 0 || car >= MAX_CARS) { printf("Invalid car id.\n"); return; }
-    if (slotOfCar[car] >= 1) {
-        char buf[32];
-        format_time(entryTimeOfCar[car], buf, sizeof(buf));
-        printf("Car %d parked at Slot %d (entry %s)\n", car, slotOfCar[car], buf);
-    } else if (slotOfCar[car] == -2) {
-        printf("Car %d is in the waiting queue.\n", car);
-    } else {
-        printf("Car %d not found.\n", car);
+/* a rebuilt free set is in slot order */
+void modelRebuild(int z) {
+    for (int s = zones[z].first; s <= zones[z].last; s++)
+        if (model.owner[s] == -1) model.freed[s] = ++model.tick;
+}
+
+void modelEntry(int car, time_t now, GateResult *r) {
+    r->nextCar = -1;
+    if (car < 0 || car >= numCars) { r->status = GATE_INVALID; return; }
+    if (model.slot[car] >= 1) { r->status = GATE_DUP_PARKED; return; }
+    if (model.slot[car] == -2) { r->status = GATE_DUP_WAITING; return; }
+    if (model.slot[car] == -3) {
+        r->status = GATE_ACCEPTED;
+        r->slot = model.offer[car];
+        model.slot[car] = r->slot;
+        model.entry[car] = now;
+        model.offer[car] = 0;
+        return;
+    }
+    int s = -1;
+    for (int k = 0; k < numZones && s == -1; k++) s = modelFreeSlot((car + k) % numZones);
+    if (s == -1) {
+        int z = car % numZones;
+        for (int k = 1; k < numZones && model.queued[z] == WAIT_CAP; k++) z = (car + k) % numZones;
+        if (model.queued[z] == WAIT_CAP) { r->status = GATE_FULL; return; }
+        model.queue[z][model.queued[z]++] = car;
+        model.slot[car] = -2;
+        r->status = GATE_QUEUED;
+        r->position = model.queued[z];
+        return;
     }
+    modelPark(car, s, now);
+    r->status = GATE_PARKED;
+    r->slot = s;
 }
 
-void showParkedVehicles() {
-    printf("\nParked Cars \n");
-    int any = 0;
-    for (int s = 1; s <= MAX_SLOTS; s++) {
-        int c = slotToCar[s];
-        if (c != -1) {
-            char buf[32];
-            format_time(entryTimeOfCar[c], buf, sizeof(buf));
-            printf("Slot %d: Car %d (entry %s)\n", s, c, buf);
-            any = 1;
+void modelExit(int car, time_t now, GateResult *r) {
+    r->nextCar = -1;
+    if (car < 0 || car >= numCars) { r->status = GATE_INVALID; return; }
+    if (model.slot[car] == -1) { r->status = GATE_NOT_PARKED; return; }
+    if (model.slot[car] == -3) {
+        modelDrop(car, now, r);
+        r->status = GATE_UNQUEUED;
+        return;
+    }
+    if (model.slot[car] == -2) {
+        int z = 0, i = 0;
+        while (i == model.queued[z] || model.queue[z][i] != car)
+            if (i == model.queued[z]) z++, i = 0;
+            else i++;
+        memmove(&model.queue[z][i], &model.queue[z][i + 1], (--model.queued[z] - i) * sizeof(int));
+        model.slot[car] = -1;
+        r->status = GATE_UNQUEUED;
+        return;
+    }
+    int s = model.slot[car];
+    long secs = now - model.entry[car];
+    r->status = GATE_EXITED;
+    r->slot = s;
+    r->fee = model.pass[car] || secs <= 0 ? 0 : (int)((secs + 3599) / 3600) * FEE_PER_HOUR;
+    model.revenue += r->fee;
+    model.busy[s] += secs > 0 ? (uint64_t) secs : 0;
+    model.slot[car] = -1;
+    model.owner[s] = -1;
+    model.freed[s] = ++model.tick;
+    modelHandOff(s, now, r);
+}
+
+/* what gate 0 answers for operation j sent again: the first outcome
+   while j is in the window, GATE_STALE once it has left */
+void modelResend(int j, const GateResult *first, GateResult *r) {
+    for (int k = 0; k < model.nSent; k++)
+        if (model.sent[k] == j) { *r = *first; return; }
+    r->status = GATE_STALE;
+    r->nextCar = -1;
+}
+
+void modelSent(int i) {
+    if (model.nSent == DEDUP_WINDOW) {
+        model.sentFloor = model.sent[0];
+        memmove(&model.sent[0], &model.sent[1], (DEDUP_WINDOW - 1) * sizeof(int));
+        model.nSent--;
+    }
+    model.sent[model.nSent++] = i;
+}
+
+/* compares one outcome, then the cars it touched; writes why on mismatch */
+int propCompare(int car, const GateResult *got, const GateResult *want, char *err, size_t errsz) {
+    if (got->status != want->status) {
+        snprintf(err, errsz, "status %d, model expects %d", got->status, want->status);
+        return 1;
+    }
+    int st = want->status;
+    if ((st == GATE_PARKED || st == GATE_EXITED || st == GATE_ACCEPTED) && got->slot != want->slot) {
+        snprintf(err, errsz, "slot %d, model expects %d", got->slot, want->slot);
+        return 1;
+    }
+    if (st == GATE_EXITED && got->fee != want->fee) {
+        snprintf(err, errsz, "fee %d, model expects %d", got->fee, want->fee);
+        return 1;
+    }
+    if (st == GATE_QUEUED && got->position != want->position) {
+        snprintf(err, errsz, "queue position %d, model expects %d", got->position, want->position);
+        return 1;
+    }
+    if (got->nextCar != want->nextCar || (want->nextCar != -1 && got->nextSlot != want->nextSlot)) {
+        snprintf(err, errsz, "handoff to car %d slot %d, model expects car %d slot %d",
+                 got->nextCar, got->nextCar != -1 ? got->nextSlot : -1, want->nextCar, want->nextCar != -1 ? want->nextSlot : -1);
+        return 1;
+    }
+    if (car >= 0 && car < numCars && carHot[car].slot != model.slot[car]) {
+        snprintf(err, errsz, "car %d at %d, model has %d", car, carHot[car].slot, model.slot[car]);
+        return 1;
+    }
+    return 0;
+}
+
+/* everything the model knows, plus the structural invariants */
+int propCompareAll(char *err, size_t errsz) {
+    for (int c = 0; c < numCars; c++)
+        if (carHot[c].slot != model.slot[c] || carHot[c].offer != model.offer[c]) {
+            snprintf(err, errsz, "car %d at %d offered %d, model has %d offered %d", c, carHot[c].slot,
+                     carHot[c].offer, model.slot[c], model.offer[c]);
+            return 1;
+        }
+    for (int z = 0; z < numZones; z++)
+        if (zones[z].policy != model.policy[z]) {
+            snprintf(err, errsz, "zone %d is %s, model has %s", z, allocPolicyName[zones[z].policy],
+                     allocPolicyName[model.policy[z]]);
+            return 1;
+        }
+    for (int s = 1; s <= numSlots; s++) {
+        int c = slotState[s].car == SLOT_FREE ? -1 : slotCar(s);
+        if (c != model.owner[s]) {
+            snprintf(err, errsz, "slot %d holds car %d, model has %d", s, c, model.owner[s]);
+            return 1;
+        }
+        if (slotUse[s].busySecs != (model.busy[s] < UINT32_MAX ? model.busy[s] : UINT32_MAX)) {
+            snprintf(err, errsz, "slot %d busy %llu s, model has %llu", s,
+                     (unsigned long long) slotUse[s].busySecs, (unsigned long long) model.busy[s]);
+            return 1;
         }
     }
-    if (!any) printf("None\n");
+    for (int z = 0; z < numZones; z++) {
+        const WaitQueue *w = &zones[z].wait;
+        int bad = w->count != model.queued[z];
+        for (int i = 0; !bad && i < w->count; i++) bad = w->q[(w->front + i) % WAIT_CAP] != model.queue[z][i];
+        if (bad) {
+            snprintf(err, errsz, "zone %d queue differs from the model (%d cars, model %d)", z, w->count, model.queued[z]);
+            return 1;
+        }
+    }
+    if (totalRevenue != model.revenue) {
+        snprintf(err, errsz, "revenue %d, model has %ld", totalRevenue, model.revenue);
+        return 1;
+    }
+    return checkAll(err, errsz) != 0 || dedupCheck(err, errsz) != 0;
 }
 
-void showWaitingQueue() {
-    printf("\nWaiting Queue (%d/%d) \n", waitCount, WAIT_CAP);
-    if (waitCount == 0) { printf("Empty\n"); return; }
-    int idx = waitFront;
-    for (int i = 0; i < waitCount; i++) {
-        printf("%d. Car %d\n", i+1, waitQ[idx]);
-        idx = (idx + 1) % WAIT_CAP;
+/* runs one sequence from an empty lot; index of the failing operation,
+   n if only the final comparison failed, -1 if all is well */
+int propRun(const PropOp *ops, int n, char *err, size_t errsz) {
+    static GateResult first[PROP_MAX_OPS];     /* model outcome of each entry and exit */
+    propReset();
+    time_t now = slotEpoch;
+    GateResult got, want;
+    for (int i = 0; i < n; i++) {
+        const PropOp *o = &ops[i];
+        now += o->dt;
+        if (holdSecs > 0) {
+            timerRun(now);
+            modelExpire(now);
+        }
+        switch (o->op) {
+            case PO_ENTRY:
+                gateRequest(0, (uint32_t) i, TR_ENTRY, o->car, now, &got);
+                modelEntry(o->car, now, &want);
+                modelSent(i);
+                first[i] = want;
+                break;
+            case PO_EXIT:
+                gateRequest(0, (uint32_t) i, TR_EXIT, o->car, now, &got);
+                modelExit(o->car, now, &want);
+                modelSent(i);
+                first[i] = want;
+                break;
+            case PO_RESEND: {
+                /* the same request again: same answer, nothing moves */
+                int j = i - o->car;
+                if (j < 0 || (ops[j].op != PO_ENTRY && ops[j].op != PO_EXIT)) continue;
+                gateRequest(0, (uint32_t) j, ops[j].op == PO_ENTRY ? TR_ENTRY : TR_EXIT, ops[j].car, now, &got);
+                modelResend(j, &first[j], &want);
+                if (propCompare(ops[j].car, &got, &want, err, errsz)) return i;
+                continue;
+            }
+            case PO_PASS: {
+                int ok = passAt(o->car, now);
+                if (ok != (o->car >= 0 && o->car < numCars)) {
+                    snprintf(err, errsz, "pass for car %d returned %d", o->car, ok);
+                    return i;
+                }
+                if (ok) model.pass[o->car] = 1;
+                continue;
+            }
+            case PO_POLICY: {
+                int z = o->car / ALLOC_POLICIES, p = o->car % ALLOC_POLICIES;
+                if (!policyAt(z, p, now)) {
+                    snprintf(err, errsz, "zone %d refused policy %s", z, allocPolicyName[p]);
+                    return i;
+                }
+                model.policy[z] = p;
+                modelRebuild(z);
+                continue;
+            }
+            default:
+                emergencyAt(now);
+                for (int c = 0; c < numCars; c++) {
+                    if (model.slot[c] >= 1 && now > model.entry[c]) model.busy[model.slot[c]] += now - model.entry[c];
+                    model.slot[c] = -1;
+                    model.offer[c] = 0;
+                }
+                for (int s = 1; s <= numSlots; s++) model.owner[s] = -1;
+                for (int z = 0; z < numZones; z++) modelRebuild(z);
+                memset(model.queued, 0, sizeof(model.queued));
+                continue;
+        }
+        if (propCompare(o->car, &got, &want, err, errsz)) return i;
     }
+    return propCompareAll(err, errsz) ? n : -1;
 }
 
-void showRevenue() {
-    printf("\nTotal Revenue: Rs %d\n", totalRevenue);
+const char *propOpName[] = { "entry", "exit", "pass", "emergency", "policy", "resend" };
+
+/* greedy shrink: drop each operation in turn while the run still fails,
+   cutting the tail after the failure as it moves; returns the new length */
+int propShrink(PropOp *ops, int n, char *err, size_t errsz) {
+    PropOp saved;
+    for (int j = n - 1; j >= 0; j--) {
+        if (j >= n) continue;
+        saved = ops[j];
+        memmove(&ops[j], &ops[j + 1], (n - j - 1) * sizeof(PropOp));
+        int at = propRun(ops, n - 1, err, errsz);
+        if (at >= 0) {
+            n = at < n - 1 ? at + 1 : n - 1;
+        } else {
+            memmove(&ops[j + 1], &ops[j], (n - j - 1) * sizeof(PropOp));
+            ops[j] = saved;
+        }
+    }
+    int at = propRun(ops, n, err, errsz);  /* leaves err describing the final sequence */
+    return at >= 0 && at < n ? at + 1 : n;
 }
 
-void emergencyMode() {
-    printf("\n!!! EMERGENCY MODE ACTIVE !!!\nSystem cleared. History retained.\n");
-    for (int c = 0; c < MAX_CARS; c++) {
-        slotOfCar[c] = -1;
-        entryTimeOfCar[c] = 0;
+void propPrint(FILE *f, const PropOp *ops, int n) {
+    if (holdSecs > 0) fprintf(f, "# with --hold %ld\n", holdSecs);
+    for (int i = 0; i < n; i++) {
+        if (ops[i].dt) fprintf(f, "advance %d\n", ops[i].dt);
+        if (ops[i].op == PO_EMERGENCY) fprintf(f, "emergency\n");
+        else if (ops[i].op == PO_POLICY)
+            fprintf(f, "policy %d %s\n", ops[i].car / ALLOC_POLICIES, allocPolicyName[ops[i].car % ALLOC_POLICIES]);
+        else if (ops[i].op == PO_RESEND) {
+            int j = i - ops[i].car;
+            if (j >= 0 && (ops[j].op == PO_ENTRY || ops[j].op == PO_EXIT))
+                fprintf(f, "%s %d 0 %d\n", propOpName[ops[j].op], ops[j].car, j);
+        }
+        else if (ops[i].op == PO_PASS) fprintf(f, "pass %d\n", ops[i].car);
+        else fprintf(f, "%s %d 0 %d\n", propOpName[ops[i].op], ops[i].car, i);
     }
-    for (int s = 1; s <= MAX_SLOTS; s++) slotToCar[s] = -1;
-    heapSize = 0;
-    for (int i = 1; i <= MAX_SLOTS; i++) heapInsert(i);
-    waitFront = 0; waitRear = -1; waitCount = 0;
-    /* keep totalRevenue and history as-is */
+    fprintf(f, "check\n");
 }
 
-void addMonthlyPass(int car) {
-    if (car < 0 || car >= MAX_CARS) { printf("Invalid.\n"); return; }
-    passUser[car] = 1;
-    printf("Car %d registered as Monthly Pass.\n", car);
+/* mostly entries and exits over a car range a little wider than the lot
+   so it fills and queues, with resends reaching a little past the dedup
+   window, passes, the odd emergency or policy switch and a few invalid
+   ids */
+void propGenerate(PropOp *ops, int n, uint64_t *seed) {
+    int span = numSlots + numZones * WAIT_CAP + numSlots / 2 + 2;
+    if (span > numCars) span = numCars;
+    for (int i = 0; i < n; i++) {
+        uint64_t x = xorshift64(seed);
+        int k = (int)(x % 1000);
+        ops[i].op = k < 450 ? PO_ENTRY : k < 900 ? PO_EXIT : k < 950 ? PO_RESEND : k < 996 ? PO_PASS
+                  : k < 998 ? PO_POLICY : PO_EMERGENCY;
+        if (ops[i].op == PO_POLICY) ops[i].car = (int)((x >> 20) % (uint64_t)(numZones * ALLOC_POLICIES));
+        else if (ops[i].op == PO_RESEND) ops[i].car = 1 + (int)((x >> 20) % (DEDUP_WINDOW + 16));
+        else if ((x >> 10) % 64 == 0) ops[i].car = (x >> 16) & 1 ? -1 : numCars + (int)((x >> 17) & 1);
+        else ops[i].car = (int)((x >> 20) % (uint64_t) span);
+        ops[i].dt = (x >> 40) % 4 == 0 ? 0 : (int)((x >> 42) % 7200);
+    }
 }
 
-int canEnter(int car) {
-    if (car < 0 || car >= MAX_CARS) { printf("Invalid.\n"); return 0; }
-    if (slotOfCar[car] >= 1) { printf("Duplicate: Car %d already parked.\n", car); return 0; }
-    if (slotOfCar[car] == -2) { printf("Duplicate: Car %d already in waiting.\n", car); return 0; }
-    return 1;
+int runProp(long total, uint64_t seed) {
+    static PropOp ops[PROP_MAX_OPS];
+    char err[160];
+    if (!propModelAlloc()) { fprintf(stderr, "Out of memory.\n"); return 1; }
+    printf("Property test, %d slots / %d cars / %d zones, %ld operations, seed %llu\n",
+           numSlots, numCars, numZones, total, (unsigned long long) seed);
+    long done = 0, cases = 0;
+    double t0 = monoSeconds();
+    while (done < total) {
+        uint64_t caseSeed = seed;
+        int n = 1 + (int)(xorshift64(&seed) % PROP_MAX_OPS);
+        if (n > total - done) n = (int)(total - done);
+        propGenerate(ops, n, &seed);
+        err[0] = '\0';
+        int at = propRun(ops, n, err, sizeof(err));
+        if (at >= 0) {
+            printf("  FAIL in case %ld (rerun alone with --prop-seed %llu) at operation %d of %d: %s\n",
+                   cases, (unsigned long long) caseSeed, at, n, err);
+            n = propShrink(ops, at < n ? at + 1 : n, err, sizeof(err));
+            printf("  shrunk to %d operations (%s); as a --batch script:\n", n, err);
+            propPrint(stdout, ops, n);
+            return 1;
+        }
+        done += n;
+        cases++;
+    }
+    double secs = monoSeconds() - t0;
+    printf("  OK: %ld cases, %.2f M operations/s\n", cases, done / secs / 1e6);
+    return 0;
 }
 
-void vehicleEntry() {
-    int car;
-    if (!read_int("Enter car id (0..99): ", &car)) { printf("Invalid input.\n"); return; }
-    if (!canEnter(car)) return;
-    int slot = heapRemoveMin();
-    if (slot == -1) {
-        if (waitCount == WAIT_CAP) { printf("Parking & Waiting FULL!\n"); return; }
-        if (!enqueueWait(car)) { printf("Unable to join waiting.\n"); return; }
-        slotOfCar[car] = -2;
-        printf("Parking full: Car %d added to waiting at position %d.\n", car, waitCount);
-        return;
+#ifdef PARKING_FUZZ
+/* a small lot in two zones so queues, handoffs across zones and the full
+   lot are all reachable within a few bytes */
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)argc; (void)argv;
+    numSlots = 10;
+    numCars = 48;
+    numZones = 2;
+    histWanted = 256;
+    if (!allocTables() || !dedupAlloc() || !propModelAlloc()) abort();
+    initSystem();
+    return 0;
+}
+
+/* three bytes per operation: kind, car, minutes elapsed */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static PropOp ops[PROP_MAX_OPS];
+    int n = 0;
+    for (size_t i = 0; i + 2 < size && n < PROP_MAX_OPS; i += 3, n++) {
+        int k = data[i] % 32;
+        ops[n].op = k < 14 ? PO_ENTRY : k < 27 ? PO_EXIT : k < 28 ? PO_RESEND : k < 30 ? PO_PASS : k < 31 ? PO_POLICY : PO_EMERGENCY;
+        ops[n].car = ops[n].op == PO_POLICY ? data[i + 1] % (numZones * ALLOC_POLICIES)
+                   : ops[n].op == PO_RESEND ? 1 + data[i + 1] % (DEDUP_WINDOW + 16)
+                                            : (int) data[i + 1] % (numCars + 2) - 1;
+        ops[n].dt = data[i + 2] * 60;
     }
-    time_t now = time(NULL);
-    slotOfCar[car] = slot;
-    entryTimeOfCar[car] = now;
-    slotToCar[slot] = car;
-    char buf[32];
-    format_time(now, buf, sizeof(buf));
-    printf("Car %d parked at Slot %d (Entry: %s)\n", car, slot, buf);
-    addHistoryNode(car, slot, now, 0);
+    char err[160];
+    err[0] = '\0';
+    int at = propRun(ops, n, err, sizeof(err));
+    if (at >= 0) {
+        fprintf(stderr, "Property failed at operation %d of %d: %s\n", at, n, err);
+        propPrint(stderr, ops, at < n ? at + 1 : n);
+        abort();
+    }
+    return 0;
 }
+#endif
 
-void vehicleExit() {
-    int car;
-    if (!read_int("Enter car id to exit: ", &car)) { printf("Invalid input.\n"); return; }
-    if (car < 0 || car >= MAX_CARS) { printf("Invalid car id.\n"); return; }
-    if (slotOfCar[car] == -1) {
-        printf("Car %d not parked.\n", car);
-        return;
+/* ----- Benchmarks (./ds --bench) ----- */
+#define nowSeconds monoSeconds
+
+/* fills a heap of n slots in random order, then drains it; returns ns/op */
+#define DEFINE_HEAP_BENCH(D)                                                 \
+static int benchHeap##D(const int *order, int n, double *insNs, double *remNs) { \
+    void *mem;                                                               \
+    if (posix_memalign(&mem, CACHE_LINE, HEAP_STORE_LEN(n, D) * sizeof(int))) return 0; \
+    SlotHeap h = { mem, 0, n };                                              \
+    dheap##D##Reset(&h);                                                     \
+    double t0 = nowSeconds();                                                \
+    for (int i = 0; i < n; i++) dheap##D##Insert(&h, order[i]);              \
+    double t1 = nowSeconds();                                                \
+    int ok = 1, prev = 0;                                                    \
+    for (int i = 0; i < n; i++) {                                            \
+        int v = dheap##D##RemoveMin(&h);                                     \
+        ok &= v > prev;                                                      \
+        prev = v;                                                            \
+    }                                                                        \
+    double t2 = nowSeconds();                                                \
+    free(mem);                                                               \
+    *insNs = (t1 - t0) * 1e9 / n;                                            \
+    *remNs = (t2 - t1) * 1e9 / n;                                            \
+    return ok;                                                               \
+}
+
+DEFINE_HEAP_BENCH(2)
+DEFINE_HEAP_BENCH(4)
+DEFINE_HEAP_BENCH(8)
+
+void benchHeaps() {
+    static const int sizes[] = { 1 << 16, 1 << 18, 1 << 20, 1 << 22 };
+    printf("\nSlot heap: ns/op (insert shuffled, removeMin until empty), compiled arity %d\n", HEAP_ARITY);
+    printf("%9s | %17s | %17s | %17s\n", "slots", "2-ary ins/rem", "4-ary ins/rem", "8-ary ins/rem");
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        int n = sizes[k];
+        int *order = malloc(n * sizeof(int));
+        if (!order) return;
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        for (int i = 0; i < n; i++) order[i] = i + 1;
+        for (int i = n - 1; i > 0; i--) {
+            int j = (int)(xorshift64(&seed) % (uint64_t)(i + 1));
+            int t = order[i]; order[i] = order[j]; order[j] = t;
+        }
+        double ins[3] = { 0 }, rem[3] = { 0 };
+        int ok = benchHeap2(order, n, &ins[0], &rem[0])
+               & benchHeap4(order, n, &ins[1], &rem[1])
+               & benchHeap8(order, n, &ins[2], &rem[2]);
+        printf("%9d | %7.1f / %7.1f | %7.1f / %7.1f | %7.1f / %7.1f%s\n", n,
+               ins[0], rem[0], ins[1], rem[1], ins[2], rem[2], ok ? "" : "  ORDER ERROR");
+        free(order);
     }
-    if (slotOfCar[car] == -2) {
-        /* remove from waiting queue by rebuilding queue */
-        int tmp[WAIT_CAP];
-        int idx = 0;
-        int removed = 0;
-        int origCount = waitCount;
-        for (int i = 0; i < origCount; i++) {
-            int w = dequeueWait();
-            if (w == car) { removed = 1; slotOfCar[w] = -1; }
-            else tmp[idx++] = w;
+}
+
+void benchFreeScan() {
+    int n = 1 << 22;
+    SlotState *st = malloc((n + 1) * sizeof(SlotState));
+    int *out = malloc(n * sizeof(int));
+    if (!st || !out) { free(st); free(out); return; }
+    uint64_t seed = 12345;
+    for (int i = 0; i <= n; i++) {
+        st[i].car = (xorshift64(&seed) % 10) ? (uint32_t)i & SLOT_CAR_MASK : SLOT_FREE;
+        st[i].entryRel = st[i].car == SLOT_FREE ? 0 : i;
+    }
+    FreeScanFn fast = pickFreeScan();
+    printf("\nFree-slot scan over %d slots (~10%% free): ns/slot\n", n);
+    printf("%8s | %8s | %8s\n", "", "count", "list");
+    FreeScanFn fns[2] = { freeScanScalar, fast };
+    const char *names[2] = { "scalar", "simd" };
+    int counts[2][2];
+    for (int f = 0; f < 2; f++) {
+        double t0 = nowSeconds();
+        counts[f][0] = fns[f](st, 1, n, NULL);
+        double t1 = nowSeconds();
+        counts[f][1] = fns[f](st, 1, n, out);
+        double t2 = nowSeconds();
+        printf("%8s | %8.3f | %8.3f\n", names[f], (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n);
+    }
+    if (counts[0][0] != counts[1][0] || counts[0][1] != counts[1][1]) printf("MISMATCH\n");
+    free(st);
+    free(out);
+}
+
+/* Dwell of pass holders over 1M full slots: the old layout
+   (slotToCar + entryTimeOfCar[car] + passUser[car]) against SlotState. */
+void benchSlotLayout() {
+    int n = 1 << 20;
+    int *toCar = malloc((n + 1) * sizeof(int));
+    time_t *entry = malloc(n * sizeof(time_t));
+    int *pass = malloc(n * sizeof(int));
+    SlotState *st = malloc((n + 1) * sizeof(SlotState));
+    if (!toCar || !entry || !pass || !st) { free(toCar); free(entry); free(pass); free(st); return; }
+    uint64_t seed = 777;
+    time_t base = 1700000000;
+    for (int s = 1; s <= n; s++) toCar[s] = s - 1;
+    for (int s = n; s > 1; s--) {  /* cars scattered over the car tables */
+        int j = 1 + (int)(xorshift64(&seed) % (uint64_t)s);
+        int t = toCar[s]; toCar[s] = toCar[j]; toCar[j] = t;
+    }
+    for (int s = 1; s <= n; s++) {
+        int car = toCar[s];
+        entry[car] = base + s;
+        pass[car] = s % 3 == 0;
+        st[s].car = (uint32_t)car | (pass[car] ? SLOT_F_PASS : 0);
+        st[s].entryRel = s;
+    }
+    time_t now = base + n;
+    double t0 = nowSeconds();
+    long long oldSum = 0;
+    for (int s = 1; s <= n; s++) {
+        int c = toCar[s];
+        if (c != -1 && pass[c]) oldSum += now - entry[c];
+    }
+    double t1 = nowSeconds();
+    long long newSum = 0;
+    int32_t nowRel = (int32_t)(now - base);
+    for (int s = 1; s <= n; s++) {
+        uint32_t c = st[s].car;
+        if (c != SLOT_FREE && (c & SLOT_F_PASS)) newSum += nowRel - st[s].entryRel;
+    }
+    double t2 = nowSeconds();
+    printf("\nSlot state layout, dwell scan over %d slots\n", n);
+    printf("  old: %2zu bytes/slot, %6.2f ns/slot\n",
+           sizeof(int) + sizeof(time_t) + sizeof(int), (t1 - t0) * 1e9 / n);
+    printf("  new: %2zu bytes/slot, %6.2f ns/slot%s\n",
+           sizeof(SlotState), (t2 - t1) * 1e9 / n, oldSum == newSum ? "" : "  MISMATCH");
+    free(toCar); free(entry); free(pass); free(st);
+}
+
+/* Hardware cache-miss counters around a benchmark loop (Linux only).
+   Falls back to reporting nothing when perf events are not permitted. */
+typedef struct {
+    int fd[2];          /* L1D read misses, last-level cache misses */
+} PerfCounters;
+
+void perfOpen(PerfCounters *pc) {
+    pc->fd[0] = pc->fd[1] = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    uint64_t configs[2] = {
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    for (int i = 0; i < 2; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        pc->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+void perfStart(PerfCounters *pc) {
+#ifdef __linux__
+    for (int i = 0; i < 2; i++) {
+        if (pc->fd[i] < 0) continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)pc;
+#endif
+}
+
+/* stops the counters; out[i] is -1 when counter i is unavailable */
+void perfStop(PerfCounters *pc, long long out[2]) {
+    for (int i = 0; i < 2; i++) {
+        out[i] = -1;
+#ifdef __linux__
+        long long v;
+        if (pc->fd[i] < 0) continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(pc->fd[i], &v, sizeof(v)) == sizeof(v)) out[i] = v;
+#endif
+    }
+}
+
+void perfClose(PerfCounters *pc) {
+#ifdef __linux__
+    for (int i = 0; i < 2; i++) if (pc->fd[i] >= 0) close(pc->fd[i]);
+#else
+    (void)pc;
+#endif
+}
+
+/* Report thread for benchGate: scans snapshots back to back while the
+   gate thread keeps mutating. */
+typedef struct {
+    atomic_int stop;
+    long scans;
+    double totalSec, maxSec;
+} ReportBench;
+
+void *benchReporter(void *p) {
+    ReportBench *rb = p;
+    while (!atomic_load(&rb->stop)) {
+        double t0 = nowSeconds();
+        Snapshot *sn = snapshotAcquire();
+        if (sn) {
+            int parked = 0, walked = 0;
+            for (int s = 1; s <= sn->numSlots; s++) parked += sn->slots[s].car != SLOT_FREE;
+            Node rec;
+            for (Node *t = sn->history; walked < 100000 && snapHistRead(sn, t, &rec); t = rec.next)
+                walked += snapExitTime(sn, &rec) == 0;
+            snapshotRelease();
+            if (parked < 0 || walked < 0) printf("?");
         }
-        for (int i = 0; i < idx; i++) enqueueWait(tmp[i]);
-        if (removed) printf("Car %d removed from waiting queue.\n", car);
-        else printf("Car %d not found in waiting queue.\n", car);
-        return;
+        double dt = nowSeconds() - t0;
+        rb->scans++;
+        rb->totalSec += dt;
+        if (dt > rb->maxSec) rb->maxSec = dt;
+        sched_yield();
     }
-    int slot = slotOfCar[car];
-    time_t now = time(NULL);
-    time_t entry = entryTimeOfCar[car];
-    double diff = difftime(now, entry);
-    if (diff < 0) diff = 0;
-    long secs = (long) diff;
-    int hours = secs / 3600;
-    int mins = (secs % 3600) / 60;
-    int secs_rem = secs % 60;
-    int charged_hours = (secs + 3599) / 3600; /* ceil to next hour */
-    if (charged_hours < 0) charged_hours = 0;
-    int fee = passUser[car] ? 0 : charged_hours * FEE_PER_HOUR;
-    char bufEntry[32], bufExit[32];
-    format_time(entry, bufEntry, sizeof(bufEntry));
-    format_time(now, bufExit, sizeof(bufExit));
-    printf("Car %d exited from Slot %d\n", car, slot);
-    printf("Entry : %s\n", bufEntry);
-    printf("Exit  : %s\n", bufExit);
-    printf("Duration: %d hr %d min %d sec\n", hours, mins, secs_rem);
-    printf("Fee: Rs %d\n", fee);
-    totalRevenue += fee;
-    /* update history node */
-    Node *t = history;
-    while (t) {
-        if (t->car == car && t->slot == slot && t->exitTime == 0) { t->exitTime = now; break; }
-        t = t->next;
+    return NULL;
+}
+
+int cmpDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Steady-state gate traffic on a full 1M-slot lot: every step exits a
+   random parked car and admits a random absent one. */
+void benchGate(int huge, int reporter) {
+    numSlots = 1 << 20;
+    numCars = 1 << 22;
+    useHugePages = huge;
+    if (!allocTables()) { freeTables(); return; }
+    initSystem();
+    int *parked = malloc(numSlots * sizeof(int));
+    int *absent = malloc(numCars * sizeof(int));
+    if (!parked || !absent) { free(parked); free(absent); return; }
+    uint64_t seed = 4242;
+    for (int c = 0; c < numCars; c++) absent[c] = c;
+    for (int c = numCars - 1; c > 0; c--) {
+        int j = (int)(xorshift64(&seed) % (uint64_t)(c + 1));
+        int t = absent[c]; absent[c] = absent[j]; absent[j] = t;
     }
-    /* free slot */
-    slotOfCar[car] = -1;
-    entryTimeOfCar[car] = 0;
-    slotToCar[slot] = -1;
-    heapInsert(slot);
-    /* allocate to next waiting car immediately (if any) */
-    if (waitCount > 0) {
-        int next = dequeueWait();
-        if (next >= 0 && next < MAX_CARS) {
-            int newSlot = heapRemoveMin();
-            if (newSlot == -1) { enqueueWait(next); }
-            else {
-                time_t now2 = time(NULL);
-                slotOfCar[next] = newSlot;
-                entryTimeOfCar[next] = now2;
-                slotToCar[newSlot] = next;
-                addHistoryNode(next, newSlot, now2, 0);
-                char buf2[32];
-                format_time(now2, buf2, sizeof(buf2));
-                printf("Allocated Slot %d to waiting Car %d (Entry: %s)\n", newSlot, next, buf2);
-            }
+    for (int c = 0; c < numCars; c += 3) carHot[absent[c]].flags |= CAR_F_PASS;
+    int nParked = 0, nAbsent = numCars;
+    time_t now = slotEpoch;
+    GateResult r;
+    while (nParked < numSlots) {
+        int car = absent[--nAbsent];
+        gateEntry(car, now, &r);
+        parked[nParked++] = car;
+    }
+    int steps = 1 << 21;
+    ReportBench rb = { 0, 0, 0, 0 };
+    pthread_t rtid;
+    if (reporter && pthread_create(&rtid, NULL, benchReporter, &rb) != 0) reporter = 0;
+    PerfCounters pc;
+    perfOpen(&pc);
+    perfStart(&pc);
+    /* with incremental checks, blocks alternate with checks off so the
+       overhead is measured against the same lot at the same moment */
+    int checked = checkMode == CHECK_INCREMENTAL, block = 1 << 12, blocks = 0;
+    double spent[2] = { 0, 0 }, took[(1 << 21) >> 12];
+    double t0 = nowSeconds();
+    for (int b = 0; b < steps; b += block) {
+        if (checked) checkMode = (b / block) % 2 ? CHECK_INCREMENTAL : CHECK_OFF;
+        double tb = nowSeconds();
+        for (int i = b; i < b + block && i < steps; i++) {
+            now += 7;
+            int pi = (int)(xorshift64(&seed) % (uint64_t)nParked);
+            int ai = (int)(xorshift64(&seed) % (uint64_t)nAbsent);
+            int out = parked[pi], in = absent[ai];
+            gateExit(out, now, &r);
+            gateEntry(in, now, &r);
+            parked[pi] = in;
+            absent[ai] = out;
         }
+        took[blocks] = nowSeconds() - tb;
+        spent[checkMode != CHECK_OFF] += took[blocks++];
     }
+    double t1 = nowSeconds();
+    if (checked) checkMode = CHECK_INCREMENTAL;
+    long long miss[2];
+    perfStop(&pc, miss);
+    perfClose(&pc);
+    if (reporter) {
+        atomic_store(&rb.stop, 1);
+        pthread_join(rtid, NULL);
+    }
+    int ops = 2 * steps;
+    printf("\nGate path, %d slots / %d cars, %zu-byte hot car record, hugepages %s%s%s\n",
+           numSlots, numCars, sizeof(CarHot), huge ? "on" : "off", reporter ? ", concurrent reports" : "",
+           checkMode == CHECK_INCREMENTAL ? ", incremental checks" : "");
+    if (reporter && rb.scans)
+        printf("  %ld snapshot reports, avg %.2f ms, max %.2f ms\n", rb.scans,
+               rb.totalSec * 1e3 / rb.scans, rb.maxSec * 1e3);
+    if (huge) {
+        printf("  ");
+        reportPages();
+    }
+    if (checked) {
+        /* each checked block against the mean of its unchecked neighbours,
+           median over all, so neither drift nor a stall in one block counts */
+        int n = 0;
+        for (int k = 1; k + 1 < blocks; k += 2) took[n++] = 2 * took[k] / (took[k - 1] + took[k + 1]);
+        qsort(took, n, sizeof(double), cmpDouble);
+        printf("  %.1f ns per entry/exit checked, %.1f ns unchecked in alternate blocks (median %+.1f%%)\n",
+               spent[1] * 1e9 / (ops / 2), spent[0] * 1e9 / (ops / 2), (took[n / 2] - 1) * 100);
+    }
+    else printf("  %.1f ns per entry/exit\n", (t1 - t0) * 1e9 / ops);
+    if (miss[0] >= 0) printf("  L1D read misses per op: %.2f\n", (double)miss[0] / ops);
+    if (miss[1] >= 0) printf("  LLC read misses per op: %.2f\n", (double)miss[1] / ops);
+    if (miss[0] < 0 && miss[1] < 0) printf("  perf counters unavailable\n");
+    free(parked);
+    free(absent);
+    freeTables();
 }
 
-void showHistory() {
-    printf("\nParking History (most recent first)\n");
-    if (!history) { printf("None\n"); return; }
-    Node *t = history;
-    while (t) {
-        char be[32], bx[32];
-        format_time(t->entryTime, be, sizeof(be));
-        if (t->exitTime == 0) {
-            printf("Car %d -> Slot %d | %s -> STILL PARKED\n", t->car, t->slot, be);
-        } else {
-            format_time(t->exitTime, bx, sizeof(bx));
-            printf("Car %d -> Slot %d | %s -> %s\n", t->car, t->slot, be, bx);
+/* Per-zone allocator traffic, one pinned worker per zone, all zones at
+   once: each worker only touches its own heap and slot-state slice. */
+typedef struct {
+    int steps;
+    double seconds;
+} ZoneBench;
+
+void benchZoneWorker(Zone *z, void *arg) {
+    ZoneBench *b = &((ZoneBench *)arg)[z - zones];
+    int n = z->last - z->first + 1;
+    int *held = malloc(n * sizeof(int));
+    if (!held) return;
+    int nHeld = 0;
+    uint64_t seed = 99 + (uint64_t)(z - zones);
+    while (nHeld < n / 2) {
+        int s = zoneTake(z);
+        slotState[s].car = (uint32_t)s & SLOT_CAR_MASK;
+        held[nHeld++] = s;
+    }
+    double t0 = nowSeconds();
+    for (int i = 0; i < b->steps; i++) {
+        int k = (int)(xorshift64(&seed) % (uint64_t)nHeld);
+        slotRelease(held[k]);
+        zoneGive(z, held[k]);
+        int s = zoneTake(z);
+        slotState[s].car = (uint32_t)s & SLOT_CAR_MASK;
+        held[k] = s;
+    }
+    b->seconds = nowSeconds() - t0;
+    free(held);
+}
+
+void benchZones() {
+    int saved = numZones;
+    numSlots = 1 << 22;
+    numCars = 1;
+    numZones = numCpus > 1 ? (numCpus < 8 ? numCpus : 8) : 2;
+    if (!allocTables()) { freeTables(); numZones = saved; return; }
+    ZoneBench b[MAX_ZONES];
+    for (int z = 0; z < numZones; z++) b[z] = (ZoneBench){ 1 << 21, 0 };
+    zonesRunOnWorkers(benchZoneWorker, b);
+    double ops = 0, slowest = 0;
+    for (int z = 0; z < numZones; z++) {
+        ops += 2.0 * b[z].steps;
+        if (b[z].seconds > slowest) slowest = b[z].seconds;
+    }
+    printf("\nSharded allocator, %d slots in %d zones, %d node%s, %s\n", numSlots, numZones,
+           numaNodes, numaNodes == 1 ? "" : "s", pinZones ? "pinned" : "unpinned");
+    printf("  %.1f M alloc/release per second overall\n", slowest > 0 ? ops / slowest / 1e6 : 0.0);
+    freeTables();
+    numZones = saved;
+}
+
+/* Journal at a steady 100k events/s for one second: how long each event
+   waits until its group is on disk. Written to the current directory,
+   since tmpfs would make the fsync free. */
+void benchJournal(int uring) {
+    const char *path = "ds-journal-bench.tmp";
+    const int rate = 100000, events = rate;
+    int saved = useUring;
+    useUring = uring;
+    LogWriter *w = logOpen(path, 1);
+    useUring = saved;
+    if (!w) { printf("\nJournal: cannot create %s\n", path); return; }
+    w->window = JOURNAL_WINDOW;
+    w->stamps = malloc((size_t)LOG_BUFS * LOG_STAMPS * sizeof(double));
+    w->lat = malloc(events * sizeof(double));
+    w->capLat = events;
+    if (!w->stamps || !w->lat) { logClose(w); unlink(path); return; }
+    journal = w;
+    double t0 = nowSeconds(), lag = 0;
+    for (int i = 0; i < events; i++) {
+        double due = t0 + (double) i / rate;
+        double now;
+        while ((now = nowSeconds()) < due) {}
+        if (now - due > lag) lag = now - due;
+        journalEvent(JR_ENTRY, i % 1000, i % 100 + 1, 0, (time_t) i);
+    }
+    logFlush(w, 1);
+    double elapsed = nowSeconds() - t0;
+    journal = NULL;
+    printf("\nJournal, %d events at %dk/s, %s, %.0f ms group commit\n", events, rate / 1000,
+           logBackendName(w), JOURNAL_WINDOW * 1e3);
+    if (w->nLat) {
+        qsort(w->lat, w->nLat, sizeof(double), cmpDouble);
+        printf("  durability latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               w->lat[w->nLat / 2] * 1e3, w->lat[w->nLat * 99 / 100] * 1e3, w->lat[w->nLat - 1] * 1e3);
+    }
+    printf("  %.0f events/s sustained, producer fell behind by at most %.2f ms%s\n",
+           events / elapsed, lag * 1e3, w->failed ? ", WRITE ERRORS" : "");
+    logClose(w);
+    unlink(path);
+}
+
+/* one zone half full; each step frees a random held slot after a stay
+   of up to two hours and takes the next one the policy hands out */
+void benchPolicies() {
+    int savedZones = numZones, savedPolicy = allocPolicy[0];
+    numSlots = 1 << 20;
+    numCars = 1;
+    numZones = 1;
+    allocPolicy[0] = ALLOC_LOWEST;
+    int *held = malloc((numSlots / 2) * sizeof(int));
+    if (!held || !allocTables()) { free(held); freeTables(); numZones = savedZones; return; }
+    int steps = 1 << 21;
+    printf("\nAllocation policies, %d slots, half taken, %d release/allocate pairs\n", numSlots, steps);
+    for (int p = 0; p < ALLOC_POLICIES; p++) {
+        Zone *z = &zones[0];
+        memset(slotUse, 0, (numSlots + 1) * sizeof(SlotUse));
+        zoneReset(z);
+        if (!zoneSetPolicy(z, p)) continue;
+        uint64_t seed = 99;
+        int nHeld = 0;
+        while (nHeld < numSlots / 2) {
+            int s = zoneTake(z);
+            slotState[s].car = (uint32_t)s & SLOT_CAR_MASK;
+            held[nHeld++] = s;
+        }
+        double t0 = nowSeconds();
+        for (int i = 0; i < steps; i++) {
+            uint64_t x = xorshift64(&seed);
+            int k = (int)(x % (uint64_t) nHeld);
+            slotUseAdd(held[k], (long)((x >> 32) % 7200));
+            slotRelease(held[k]);
+            zoneGive(z, held[k]);
+            int s = zoneTake(z);
+            slotState[s].car = (uint32_t)s & SLOT_CAR_MASK;
+            held[k] = s;
         }
-        t = t->next;
+        double secs = nowSeconds() - t0;
+        /* spread: the busiest slot's share against the mean */
+        uint64_t most = 0, sum = 0;
+        for (int s = 1; s <= numSlots; s++) {
+            sum += slotUse[s].busySecs;
+            if (slotUse[s].busySecs > most) most = slotUse[s].busySecs;
+        }
+        printf("  %-12s %6.1f ns per pair, busiest slot %.1fx the mean\n", allocPolicyName[p],
+               secs / steps * 1e9, sum ? (double) most * numSlots / sum : 0.0);
     }
+    free(held);
+    freeTables();
+    numZones = savedZones;
+    allocPolicy[0] = savedPolicy;
 }
 
-void showFreeSlots() {
-    printf("Free Slots: ");
-    int any = 0;
-    for (int s = 1; s <= MAX_SLOTS; s++) if (slotToCar[s] == -1) { printf("%d ", s); any = 1; }
-    if (!any) printf("None");
-    printf("\n");
+static long benchFired;
+
+static void benchTimerFire(int32_t arg, time_t now) {
+    (void) arg;
+    (void) now;
+    benchFired++;
+}
+
+/* deadlines spread over 30 days, half cancelled, the rest run out */
+void benchTimers() {
+    int n = 1 << 22;
+    uint64_t *handle = malloc(n * sizeof(uint64_t));
+    int savedVirtual = clockVirtual;
+    time_t savedClock = clockValue, start = 1700000000;
+    if (!handle || !timerReset(start, n)) { free(handle); timerFree(); return; }
+    uint64_t seed = 42;
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) handle[i] = timerAdd(start + 1 + (time_t)(xorshift64(&seed) % (30 * 86400)), benchTimerFire, i);
+    double t1 = nowSeconds();
+    for (int i = 0; i < n; i += 2) timerCancel(handle[i]);
+    double t2 = nowSeconds();
+    benchFired = 0;
+    clockVirtual = 0;
+    timerRun(start + 30 * 86400);
+    double t3 = nowSeconds();
+    printf("\nTimer wheel, %d timers over 30 days: add %.1f ns, cancel %.1f ns, fire %.1f ns (%ld fired, %ld left)\n",
+           n, (t1 - t0) / n * 1e9, (t2 - t1) / (n / 2) * 1e9, (t3 - t2) / (benchFired ? benchFired : 1) * 1e9,
+           benchFired, timersPending);
+    clockVirtual = savedVirtual;
+    clockValue = savedClock;
+    free(handle);
+    timerFree();
+}
+
+/* end-of-day scan over a full history ring at 1, 2, 4 ... threads */
+void benchEod() {
+    int savedSlots = numSlots, savedCars = numCars, savedZones = numZones;
+    long savedHist = histWanted;
+    numSlots = 1 << 16;
+    numCars = 1 << 16;
+    numZones = 1;
+    histWanted = 1 << 23;
+    if (!allocTables()) { freeTables(); numSlots = savedSlots; numCars = savedCars; numZones = savedZones; histWanted = savedHist; return; }
+    initSystem();
+    uint64_t seed = 7;
+    time_t start = 1700000000;
+    for (long i = 0; i < histCap; i++) {
+        uint64_t x = xorshift64(&seed);
+        time_t entry = start + (time_t)(i * 30 * 86400 / histCap);
+        Node *n = addHistoryNode((int)(x % (uint64_t) numCars), 1 + (int)((x >> 20) % (uint64_t) numSlots), entry, 0);
+        n->exitTime = entry + 60 + (time_t)((x >> 40) % 14400);
+        n->fee = (int)((n->exitTime - entry + 3599) / 3600) * FEE_PER_HOUR;
+        n->exitSeq = 1;
+    }
+    Snapshot *sn = snapshotAcquire();
+    time_t day0 = eodDay0(start + 30 * 86400, 30);
+    int most = histThreads() > 16 ? histThreads() : 16;
+    printf("\nEnd-of-day scan, %ld stays over 30 days, %d slots\n", histCap, numSlots);
+    double base = 0;
+    for (int t = 1; t <= most && sn; t *= 2) {
+        double t0 = nowSeconds();
+        EodPart *p = eodRun(sn, day0, 30, t);
+        double secs = nowSeconds() - t0;
+        if (!p) break;
+        if (t == 1) base = secs;
+        printf("  %2d thread%s %7.1f ms  %6.1f M stays/s  x%.2f\n", t, t == 1 ? " " : "s", secs * 1e3,
+               p->scanned / secs / 1e6, base / secs);
+        eodPartFree(p);
+    }
+    Query q;
+    char err[128];
+    const char *text = "count, avg(duration), sum(fee) where duration > 2h and zone = 0 and hour >= 8 group by hour";
+    if (sn && queryCompile(text, &q, err, sizeof(err))) {
+        QueryPart res;
+        int threads = histThreads();
+        double t0 = nowSeconds();
+        if (queryExec(sn, &q, threads, &res)) {
+            double secs = nowSeconds() - t0;
+            printf("  query on %d thread%s %6.1f ms  %6.1f M stays/s: %s\n", threads, threads == 1 ? "" : "s",
+                   secs * 1e3, res.scanned / secs / 1e6, text);
+            free(res.row);
+        }
+    }
+    if (sn) snapshotRelease();
+    freeTables();
+    histReset();
+    numSlots = savedSlots;
+    numCars = savedCars;
+    numZones = savedZones;
+    histWanted = savedHist;
+}
+
+int runBench() {
+    benchHeaps();
+    benchFreeScan();
+    benchSlotLayout();
+    benchGate(0, 0);
+    benchGate(1, 0);
+    benchGate(0, 1);
+    useHugePages = 0;
+    checkMode = CHECK_INCREMENTAL;
+    benchGate(0, 0);
+    checkMode = CHECK_OFF;
+    benchZones();
+    benchPolicies();
+    benchTimers();
+    benchEod();
+#ifdef __linux__
+    benchJournal(1);
+#endif
+    benchJournal(0);
+#ifdef GATE_PROFILE
+    profDump();
+#endif
+    return 0;
+}
+
+/* flushes and closes the journal and the trace; 0 if either lost data */
+int closeOutputs() {
+    int ok = traceClose();
+    if (!ok) fprintf(stderr, "Trace write failed\n");
+    if (journal && !logClose(journal)) { fprintf(stderr, "Journal write failed\n"); ok = 0; }
+    journal = NULL;
+    return ok;
 }
 
+#ifndef PARKING_FUZZ
 //Main menu 
-int main() {
+int main(int argc, char **argv) {
+    long prop = 0;
+    uint64_t propSeed = 1;
+    int bench = 0, allocCheck = 0, wrapCheck = 0, reorderCheck = 0, gateSim = 0, gates = 1000, rounds = 3, threads = 4;
+    const char *topology = NULL, *journalPath = NULL, *batch = NULL, *tracePath = NULL, *replay = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) bench = 1;
+        else if (strcmp(argv[i], "--slots") == 0 && i + 1 < argc) numSlots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cars") == 0 && i + 1 < argc) numCars = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--hugepages") == 0) useHugePages = 1;
+        else if (strcmp(argv[i], "--zones") == 0 && i + 1 < argc) numZones = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--topology") == 0 && i + 1 < argc) topology = argv[++i];
+        else if (strcmp(argv[i], "--gate-sim") == 0) gateSim = 1;
+        else if (strcmp(argv[i], "--gates") == 0 && i + 1 < argc) gates = numGates = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) journalPath = argv[++i];
+        else if (strcmp(argv[i], "--no-uring") == 0) useUring = 0;
+        else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) histWanted = atol(argv[++i]);
+        else if (strcmp(argv[i], "--alloc-check") == 0) allocCheck = 1;
+        else if (strcmp(argv[i], "--wrap-check") == 0) wrapCheck = 1;
+        else if (strcmp(argv[i], "--reorder-check") == 0) reorderCheck = 1;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch = argv[++i];
+        else if (strcmp(argv[i], "--profile-every") == 0 && i + 1 < argc) profEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) tracePath = argv[++i];
+        else if (strcmp(argv[i], "--trace-check") == 0 && i + 1 < argc) traceCheckEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) replay = argv[++i];
+        else if (strcmp(argv[i], "--prop") == 0 && i + 1 < argc) prop = atol(argv[++i]);
+        else if (strcmp(argv[i], "--prop-seed") == 0 && i + 1 < argc) propSeed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--alloc") == 0 && i + 1 < argc) {
+            /* one policy per zone in order; the last one covers the rest */
+            char list[256];
+            snprintf(list, sizeof(list), "%s", argv[++i]);
+            int z = 0, p = -1;
+            for (char *tok = strtok(list, ","); tok && z < MAX_ZONES; tok = strtok(NULL, ","), z++) {
+                if ((p = policyByName(tok)) < 0) {
+                    fprintf(stderr, "--alloc takes lowest, round-robin, lru or least-used, comma-separated per zone\n");
+                    return 2;
+                }
+                allocPolicy[z] = p;
+            }
+            for (; z < MAX_ZONES && p >= 0; z++) allocPolicy[z] = p;
+        }
+        else if (strcmp(argv[i], "--overstay") == 0 && i + 1 < argc) overstayLimit = (long)(atof(argv[++i]) * 3600);
+        else if (strcmp(argv[i], "--overstay-close") == 0) overstayClose = 1;
+        else if (strcmp(argv[i], "--hold") == 0 && i + 1 < argc) holdSecs = atol(argv[++i]);
+        else if (strcmp(argv[i], "--watermark") == 0 && i + 1 < argc) reorderLag = atol(argv[++i]);
+        else if (strcmp(argv[i], "--report-threads") == 0 && i + 1 < argc) reportThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            const char *m = argv[++i];
+            checkMode = strcmp(m, "full") == 0 ? CHECK_FULL : strcmp(m, "incremental") == 0 ? CHECK_INCREMENTAL
+                      : strcmp(m, "off") == 0 ? CHECK_OFF : -1;
+            if (checkMode < 0) { fprintf(stderr, "--check takes off, incremental or full\n"); return 2; }
+        }
+        else {
+            fprintf(stderr, "usage: %s [--bench] [--slots N] [--cars N] [--hugepages] [--zones N] [--topology FILE]\n"
+                            "          [--gate-sim [--gates N] [--rounds N] [--threads N]] [--journal FILE] [--no-uring]\n"
+                            "          [--history N] [--alloc-check] [--wrap-check] [--reorder-check] [--batch FILE]\n"
+                            "          [--profile-every N] [--trace FILE [--trace-check N]] [--replay FILE]\n"
+                            "          [--check off|incremental|full]\n"
+                            "          [--prop N [--prop-seed S]] [--alloc POLICY[,POLICY...]] [--overstay HOURS [--overstay-close]]\n"
+                            "          [--hold SECONDS] [--watermark SECONDS] [--report-threads N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (profEvery < 1 || traceCheckEvery < 0) { fprintf(stderr, "--profile-every must be >= 1, --trace-check >= 0\n"); return 2; }
+    if (reorderLag < 0) { fprintf(stderr, "--watermark must be >= 0\n"); return 2; }
+    if (reportThreads < 0) { fprintf(stderr, "--report-threads must be >= 0\n"); return 2; }
+    profCalibrate();
+    detectTopology();
+    if (topology && !loadTopology(topology)) { fprintf(stderr, "Cannot use topology file %s\n", topology); return 2; }
+    if (numZones < 1 || numZones > MAX_ZONES) { fprintf(stderr, "--zones must be within 1..%d\n", MAX_ZONES); return 2; }
+    if (bench) return runBench();
+    if (replay) return runReplay(replay);
+    if (gateSim) {
+        if (gates < 1 || rounds < 1 || threads < 1) { fprintf(stderr, "--gates, --rounds and --threads must be >= 1\n"); return 2; }
+        if (numCars < gates) numCars = gates;
+        numGates = gates;
+        if (numSlots == MAX_SLOTS) numSlots = gates / 2 > 0 ? gates / 2 : 1;
+    }
+    if (numSlots < 1 || numCars < 1 || (unsigned)numCars > SLOT_CAR_MASK) {
+        fprintf(stderr, "--slots must be >= 1 and --cars within 1..%u\n", SLOT_CAR_MASK);
+        return 2;
+    }
+    for (int z = 0; z < numZones; z++)
+        if (policyKeyed(allocPolicy[z]) && (numSlots + numZones - 1) / numZones > 1 << KEY_SLOT_BITS) {
+            fprintf(stderr, "--alloc %s needs zones of at most %d slots\n", allocPolicyName[allocPolicy[z]], 1 << KEY_SLOT_BITS);
+            return 2;
+        }
+    if (numGates < 1) { fprintf(stderr, "--gates must be >= 1\n"); return 2; }
+    if (!allocTables() || !dedupAlloc()) { fprintf(stderr, "Out of memory.\n"); return 1; }
     initSystem();
-    printf("Smart Parking System - Slots: %d, Waiting: %d\n", MAX_SLOTS, WAIT_CAP);
+    if (journalPath) {
+        journal = logOpen(journalPath, 0);
+        if (!journal) { fprintf(stderr, "Cannot open journal %s\n", journalPath); return 1; }
+        journal->window = JOURNAL_WINDOW;
+    }
+    if (tracePath && !traceOpen(tracePath)) { fprintf(stderr, "Cannot open trace %s\n", tracePath); return 1; }
+    if (gateSim || allocCheck || wrapCheck || reorderCheck || batch || prop > 0) {
+        int rc = gateSim ? runGateSim(gates, rounds, threads) : allocCheck ? runAllocCheck()
+               : wrapCheck ? runWrapCheck() : reorderCheck ? runReorderCheck()
+               : batch ? runBatch(batch) : runProp(prop, propSeed ? propSeed : 1);
+        if (!closeOutputs()) rc = 1;
+        return rc;
+    }
+    printf("Smart Parking System - Slots: %d, Waiting: %d\n", numSlots, WAIT_CAP);
+    if (useHugePages) reportPages();
+    if (numZones > 1 || pinZones) reportZones();
+    if (journal) printf("Journal: %s (%s)\n", journalPath, logBackendName(journal));
     char ch;
     if (!read_char("Add monthly pass users? (y/n): ", &ch)) ch = 'n';
     if (ch == 'y' || ch == 'Y') {
@@ -370,7 +7045,7 @@ int main() {
     }
     while (1) {
         printf("\n--- MENU ---\n");
-        printf("1 Entry\n2 Exit\n3 History\n4 Slot Map\n5 Search Car\n6 Revenue\n7 Parked Cars\n8 Waiting Queue\n9 Add Monthly Pass\n10 Emergency\n11 Free Slots\n12 Quit\n");
+        printf("1 Entry\n2 Exit\n3 History\n4 Slot Map\n5 Search Car\n6 Revenue\n7 Parked Cars\n8 Waiting Queue\n9 Add Monthly Pass\n10 Emergency\n11 Free Slots\n12 Quit\n13 Export History\n14 Latency Profile\n15 Check Consistency\n16 Dwell Analytics\n17 Occupancy\n18 Slot Utilization\n19 Allocation Policy\n20 Overstays\n21 End of Day\n22 Query History\n");
         int choice;
         if (!read_int("Choice: ", &choice)) continue;
         switch (choice) {
@@ -388,9 +7063,30 @@ int main() {
                 break;
             }
             case 11: showFreeSlots(); break;
-            case 12: printf("Exiting...\n"); return 0;
+            case 12:
+                printf("Exiting...\n");
+                return closeOutputs() ? 0 : 1;
+            case 13: exportHistory(); break;
+            case 14: profDump(); break;
+            case 15: showInvariants(); break;
+            case 16: dwellReport(); break;
+            case 17: occupancyReport(); break;
+            case 18: slotUseReport(); break;
+            case 19: choosePolicy(); break;
+            case 20: showOverstays(); break;
+            case 21: { int d; if (read_int("Days (1..366): ", &d)) eodReport(d); break; }
+            case 22: {
+                char q[256];
+                printf("Query (e.g. count, avg(duration) where duration > 8h and zone = 2 and entry > -7d group by hour): ");
+                fflush(stdout);
+                if (fgets(q, sizeof(q), stdin)) queryRun(q);
+                break;
+            }
             default: printf("Invalid choice.\n");
         }
+        timersTick();
+        if (journal && !logFlush(journal, 1)) printf("Warning: journal write failed.\n");
     }
     return 0;
 }
+#endif